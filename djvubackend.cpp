@@ -0,0 +1,195 @@
+#include "djvubackend.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+DjvuBackend::DjvuBackend(const char *programName)
+    : ctx(ddjvu_context_create(programName))
+{
+    ddjvu_message_set_callback(ctx, &DjvuBackend::messagePosted, this);
+    pump.reset(QThread::create([this]() { run(); }));
+    pump->start();
+}
+
+DjvuBackend::~DjvuBackend() {
+    {
+        QMutexLocker locker(&postedMutex);
+        stopping = true;
+        posted.wakeAll();
+    }
+    pump->wait();
+    ddjvu_message_set_callback(ctx, nullptr, nullptr);
+
+    for (Waiter &waiter : waiters) {
+        waiter.promise.addResult(false);
+        waiter.promise.finish();
+    }
+    ddjvu_context_release(ctx);
+}
+
+void DjvuBackend::setCacheSize(qint64 bytes) {
+    ddjvu_cache_set_size(ctx, static_cast<unsigned long>(std::max<qint64>(0, bytes)));
+}
+
+qint64 DjvuBackend::cacheSize() const {
+    return static_cast<qint64>(ddjvu_cache_get_size(ctx));
+}
+
+qint64 DjvuBackend::defaultCacheSize() {
+    constexpr qint64 MB = 1024 * 1024;
+    qint64 physical = 0;
+#ifdef Q_OS_UNIX
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0)
+        physical = static_cast<qint64>(pages) * pageSize;
+#endif
+    // A 64th of the memory, between 32 and 512 MB.
+    return physical > 0 ? std::clamp(physical / 64, 32 * MB, 512 * MB) : 64 * MB;
+}
+
+void DjvuBackend::messagePosted(ddjvu_context_t *, void *closure) {
+    static_cast<DjvuBackend *>(closure)->wake();
+}
+
+void DjvuBackend::wake() {
+    QMutexLocker locker(&postedMutex);
+    messagesPosted = true;
+    posted.wakeOne();
+}
+
+QFuture<bool> DjvuBackend::when(Status status, ddjvu_document_t *document) {
+    QPromise<bool> promise;
+    QFuture<bool> future = promise.future();
+    promise.start();
+
+    ddjvu_status_t current = status();
+    if (current >= DDJVU_JOB_OK) {
+        promise.addResult(current == DDJVU_JOB_OK);
+        promise.finish();
+        return future;
+    }
+
+    {
+        QMutexLocker locker(&waitersMutex);
+        waiters.push_back({std::move(status), document, std::move(promise)});
+    }
+    // The job may have finished between the check and the registration.
+    wake();
+    return future;
+}
+
+QFuture<bool> DjvuBackend::documentDecoded(ddjvu_document_t *document) {
+    return when([document]() { return ddjvu_document_decoding_status(document); }, document);
+}
+
+QFuture<bool> DjvuBackend::pageDecoded(ddjvu_page_t *page, ddjvu_document_t *document) {
+    return when([page]() { return ddjvu_page_decoding_status(page); }, document);
+}
+
+bool DjvuBackend::wait(const Status &status, const PageRenderer::CancelFlag *cancelled) {
+    for (;;) {
+        quint64 seen;
+        {
+            QMutexLocker locker(&progressMutex);
+            seen = generation;
+        }
+
+        ddjvu_status_t current = status();
+        if (current >= DDJVU_JOB_OK)
+            return current == DDJVU_JOB_OK;
+        if (cancelled && *cancelled)
+            return false;
+
+        // The timeout only bounds how late a cancellation is noticed.
+        QMutexLocker locker(&progressMutex);
+        if (generation == seen)
+            progress.wait(&progressMutex, 50);
+    }
+}
+
+bool DjvuBackend::waitForDocument(ddjvu_document_t *document, const PageRenderer::CancelFlag *cancelled) {
+    return wait([document]() { return ddjvu_document_decoding_status(document); }, cancelled);
+}
+
+bool DjvuBackend::waitForPage(ddjvu_page_t *page, const PageRenderer::CancelFlag *cancelled) {
+    return wait([page]() { return ddjvu_page_decoding_status(page); }, cancelled);
+}
+
+bool DjvuBackend::pageInfo(ddjvu_document_t *document, int pageNum, ddjvu_pageinfo_t *info,
+                           const PageRenderer::CancelFlag *cancelled) {
+    return wait([document, pageNum, info]() { return ddjvu_document_get_pageinfo(document, pageNum, info); },
+                cancelled);
+}
+
+void DjvuBackend::forgetDocument(ddjvu_document_t *document) {
+    // The pump only polls waiters under the lock, so once they are out of the
+    // list nothing looks at the document again.
+    std::list<Waiter> forgotten;
+    {
+        QMutexLocker locker(&waitersMutex);
+        for (auto it = waiters.begin(); it != waiters.end();) {
+            auto next = std::next(it);
+            if (it->document == document)
+                forgotten.splice(forgotten.end(), waiters, it);
+            it = next;
+        }
+    }
+    for (Waiter &waiter : forgotten) {
+        waiter.promise.addResult(false);
+        waiter.promise.finish();
+    }
+}
+
+void DjvuBackend::run() {
+    for (;;) {
+        {
+            QMutexLocker locker(&postedMutex);
+            // Messages wake the pump right away; the timeout is only a safety net.
+            if (!messagesPosted && !stopping)
+                posted.wait(&postedMutex, 500);
+            if (stopping)
+                return;
+            messagesPosted = false;
+        }
+
+        while (ddjvu_message_peek(ctx))
+            ddjvu_message_pop(ctx);
+
+        resolveWaiters();
+
+        QMutexLocker locker(&progressMutex);
+        ++generation;
+        progress.wakeAll();
+    }
+}
+
+void DjvuBackend::resolveWaiters() {
+    std::list<Waiter> finished;
+    {
+        QMutexLocker locker(&waitersMutex);
+        for (auto it = waiters.begin(); it != waiters.end();) {
+            auto next = std::next(it);
+            ddjvu_status_t status = it->status();
+            if (status >= DDJVU_JOB_OK) {
+                it->succeeded = status == DDJVU_JOB_OK;
+                finished.splice(finished.end(), waiters, it);
+            }
+            it = next;
+        }
+    }
+
+    // Outside the lock: continuations may register new waiters. The handles
+    // may already be gone by now, so the status isn't asked for again.
+    for (Waiter &waiter : finished) {
+        waiter.promise.addResult(waiter.succeeded);
+        waiter.promise.finish();
+    }
+}
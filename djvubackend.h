@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QFuture>
+#include <QMutex>
+#include <QPromise>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <functional>
+#include <list>
+#include <memory>
+
+#include "pagerenderer.h"
+
+// Owns the ddjvu context and is the only place its messages are taken from.
+// A thread of its own sleeps until libdjvu posts a message, drains the queue
+// and then resolves whoever waits for a document, page info or page decode,
+// so nobody spins on ddjvu_message_wait() and any number of pages can be
+// decoding at once. Documents are created on context() as usual.
+class DjvuBackend {
+public:
+    // The status of some job; finished once it reaches DDJVU_JOB_OK or beyond.
+    using Status = std::function<ddjvu_status_t()>;
+
+    explicit DjvuBackend(const char *programName);
+    ~DjvuBackend();
+
+    DjvuBackend(const DjvuBackend &) = delete;
+    DjvuBackend &operator=(const DjvuBackend &) = delete;
+
+    ddjvu_context_t *context() const { return ctx; }
+
+    // libdjvu's cache of decoded document components, shared by every
+    // document on the context. Its own default of 10 MB holds only a page or
+    // two of a scanned book; defaultCacheSize() scales with the machine.
+    void setCacheSize(qint64 bytes);
+    qint64 cacheSize() const;
+    static qint64 defaultCacheSize();
+
+    // Resolve with true once the job has succeeded, false if it failed or was
+    // stopped. The handles involved must stay alive until then; a job on
+    // document is stopped by forgetDocument(document).
+    QFuture<bool> when(Status status, ddjvu_document_t *document = nullptr);
+    QFuture<bool> documentDecoded(ddjvu_document_t *document);
+    QFuture<bool> pageDecoded(ddjvu_page_t *page, ddjvu_document_t *document);
+
+    // For worker threads: sleeps until the job finishes; false if it failed
+    // or cancelled was set first.
+    bool wait(const Status &status, const PageRenderer::CancelFlag *cancelled = nullptr);
+    bool waitForDocument(ddjvu_document_t *document, const PageRenderer::CancelFlag *cancelled = nullptr);
+    bool waitForPage(ddjvu_page_t *page, const PageRenderer::CancelFlag *cancelled = nullptr);
+
+    // Page size and resolution, without decoding the page.
+    bool pageInfo(ddjvu_document_t *document, int pageNum, ddjvu_pageinfo_t *info,
+                  const PageRenderer::CancelFlag *cancelled = nullptr);
+
+    // Resolves the document's pending futures with false. Call it before
+    // releasing a document the futures use.
+    void forgetDocument(ddjvu_document_t *document);
+
+private:
+    struct Waiter {
+        Status status;
+        ddjvu_document_t *document = nullptr;
+        QPromise<bool> promise;
+        bool succeeded = false;
+    };
+
+    static void messagePosted(ddjvu_context_t *context, void *closure);
+    void wake();
+    void run();
+    void resolveWaiters();
+
+    ddjvu_context_t *ctx;
+    std::unique_ptr<QThread> pump;
+
+    // Set by libdjvu's callback, which must not call back into ddjvuapi, so
+    // it only ever takes this lock.
+    QMutex postedMutex;
+    QWaitCondition posted;
+    bool messagesPosted = false;
+    bool stopping = false;
+
+    // Bumped after every drain, for the blocking waiters.
+    QMutex progressMutex;
+    QWaitCondition progress;
+    quint64 generation = 0;
+
+    QMutex waitersMutex;
+    std::list<Waiter> waiters;
+};
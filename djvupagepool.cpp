@@ -0,0 +1,101 @@
+#include "djvupagepool.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+DjvuPagePool::DjvuPagePool(DjvuBackend *djvu, int capacity)
+    : djvu(djvu), maxPages(std::max(1, capacity))
+{
+}
+
+void DjvuPagePool::setDocument(ddjvu_document_t *newDocument) {
+    QMutexLocker locker(&mutex);
+    document = newDocument;
+    lru.clear();
+    index.clear();
+}
+
+void DjvuPagePool::clear() {
+    setDocument(nullptr);
+}
+
+void DjvuPagePool::setCapacity(int pages) {
+    QMutexLocker locker(&mutex);
+    maxPages = std::max(1, pages);
+    evictToCapacity();
+}
+
+DjvuPagePool::Page DjvuPagePool::acquire(int pageNum, const PageRenderer::CancelFlag *cancelled) {
+    std::shared_ptr<Entry> entry;
+    {
+        QMutexLocker locker(&mutex);
+        if (!document)
+            return nullptr;
+
+        auto it = index.constFind(pageNum);
+        if (it != index.constEnd()) {
+            lru.splice(lru.begin(), lru, *it);
+            entry = lru.front();
+            if (ddjvu_page_decoding_status(entry->page.get()) == DDJVU_JOB_OK) {
+                ++hits;
+                if (entry->decodeNanoseconds > 0)
+                    savedNanoseconds += entry->decodeNanoseconds;
+                return entry->page;
+            }
+        } else {
+            ddjvu_page_t *page = ddjvu_page_create_by_pageno(document, pageNum);
+            if (!page)
+                return nullptr;
+
+            entry = std::make_shared<Entry>();
+            entry->pageNum = pageNum;
+            entry->page = Page(page, ddjvu_page_release);
+            entry->decodeClock.start();
+            lru.push_front(entry);
+            index.insert(pageNum, lru.begin());
+            evictToCapacity();
+        }
+        ++misses;
+    }
+
+    bool ok = djvu->waitForPage(entry->page.get(), cancelled);
+
+    QMutexLocker locker(&mutex);
+    ddjvu_status_t status = ddjvu_page_decoding_status(entry->page.get());
+    if (status >= DDJVU_JOB_OK && entry->decodeNanoseconds < 0) {
+        entry->decodeNanoseconds = entry->decodeClock.nsecsElapsed();
+        decodeNanoseconds += entry->decodeNanoseconds;
+    }
+    if (status > DDJVU_JOB_OK) {
+        // Don't keep a failed page around; a later request tries again.
+        auto it = index.find(pageNum);
+        if (it != index.end() && **it == entry) {
+            lru.erase(*it);
+            index.erase(it);
+        }
+    }
+    return ok ? entry->page : nullptr;
+}
+
+DjvuPagePool::Stats DjvuPagePool::stats() const {
+    QMutexLocker locker(&mutex);
+    Stats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.decodeNanoseconds = decodeNanoseconds;
+    stats.savedNanoseconds = savedNanoseconds;
+    stats.entries = static_cast<int>(index.size());
+    stats.capacity = maxPages;
+    return stats;
+}
+
+void DjvuPagePool::evictToCapacity() {
+    // Renders still holding an evicted page keep it alive until they finish.
+    while (index.size() > maxPages && !lru.empty()) {
+        index.remove(lru.back()->pageNum);
+        lru.pop_back();
+        ++evictions;
+    }
+}
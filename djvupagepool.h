@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+
+#include <list>
+#include <memory>
+
+#include "djvubackend.h"
+#include "pagerenderer.h"
+
+// Keeps the most recently used pages of a DjVu document decoded, so
+// rendering one again at another scale, in night mode or tile by tile
+// doesn't decode its JB2 and IW44 data a second time. A page enters the
+// pool as soon as its decode starts, so concurrent renders of it share that
+// decode and a cancelled render leaves it running for the next one.
+class DjvuPagePool {
+public:
+    using Page = std::shared_ptr<ddjvu_page_t>;
+
+    struct Stats {
+        qint64 hits = 0;      // found decoded
+        qint64 misses = 0;    // had to be decoded (or waited for)
+        qint64 evictions = 0;
+        qint64 decodeNanoseconds = 0; // spent decoding pages
+        qint64 savedNanoseconds = 0;  // decode time the hits didn't spend
+        int entries = 0;
+        int capacity = 0;
+    };
+
+    explicit DjvuPagePool(DjvuBackend *djvu, int capacity = 8);
+
+    // Drops the pages of the previous document; pages still in use stay
+    // valid until they're let go.
+    void setDocument(ddjvu_document_t *document);
+    void clear();
+
+    void setCapacity(int pages);
+
+    // The page, decoded; null if it failed to decode or cancelled was set
+    // first. Safe to call from any thread.
+    Page acquire(int pageNum, const PageRenderer::CancelFlag *cancelled = nullptr);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        int pageNum;
+        Page page;
+        QElapsedTimer decodeClock;
+        qint64 decodeNanoseconds = -1; // until the decode has been seen to finish
+    };
+    using EntryList = std::list<std::shared_ptr<Entry>>;
+
+    void evictToCapacity();
+
+    DjvuBackend *djvu;
+
+    mutable QMutex mutex;
+    ddjvu_document_t *document = nullptr;
+    int maxPages;
+
+    // Most recently used pages are at the front.
+    EntryList lru;
+    QHash<int, EntryList::iterator> index;
+
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 evictions = 0;
+    qint64 decodeNanoseconds = 0;
+    qint64 savedNanoseconds = 0;
+};
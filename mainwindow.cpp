@@ -20,9 +20,35 @@
 #include <QLineEdit>
 #include <QShortcut>
 #include <QTreeWidgetItem>
+#include <QInputDialog>
+#include <QElapsedTimer>
+#include <QStatusBar>
+#include <QClipboard>
+
+#include "textlayer.h"
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// Resident set size of this process in bytes, or -1 where it can't be read.
+static qint64 residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return -1;
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.size() > 1 ? fields[1].toLongLong() * sysconf(_SC_PAGESIZE) : -1;
+#else
+    return -1;
+#endif
+}
 
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent), ctx(ddjvu_context_create("djvu_reader"))
+    : QMainWindow(parent), ctx(djvu.context())
 {
     setAcceptDrops(true);
 
@@ -34,6 +60,37 @@ MainWindow::MainWindow(QWidget *parent)
     warmthLevel = settings.value("warmthLevel", 20).toInt();
     autoNightMode = settings.value("autoNightMode", true).toBool();
 
+    renderService = new RenderService(&djvu, this);
+    connect(renderService, &RenderService::pageSizesChanged, this, &MainWindow::relayoutPages);
+    renderService->setPrefetchDistance(settings.value("prefetchPages", 2).toInt());
+    renderService->setCacheBudget(settings.value("renderCacheMB", 256).toLongLong() * 1024 * 1024);
+    renderService->setDecodedPageCount(settings.value("decodedPages", 8).toInt());
+    djvu.setCacheSize(settings.value("djvuCacheMB", DjvuBackend::defaultCacheSize() / (1024 * 1024)).toLongLong()
+                      * 1024 * 1024);
+    thumbnailDiskCache.setBudget(settings.value("thumbnailCacheMB", 256).toLongLong() * 1024 * 1024);
+
+    textIndex = new TextIndex(this);
+    connect(textIndex, &TextIndex::progress, this, [this](int indexed, int total) {
+        if (indexed < total)
+            statusBar()->showMessage(QString("Indexing text: %1 of %2 pages").arg(indexed).arg(total));
+        else
+            statusBar()->showMessage("Text index ready", 3000);
+        if (indexed == total && textIndexPending) {
+            textIndexPending = false;
+            logOpenStage("text index");
+        }
+        continueSearchAll();
+    });
+    connect(textIndex, &TextIndex::pageIndexed, this, &MainWindow::onPageIndexed);
+    if (settings.contains("renderThreads"))
+        renderService->setThreadCount(settings.value("renderThreads").toInt());
+    openPool.setMaxThreadCount(2);
+
+    reloadTimer = new QTimer(this);
+    reloadTimer->setSingleShot(true);
+    reloadTimer->setInterval(30);
+    connect(reloadTimer, &QTimer::timeout, this, &MainWindow::reloadView);
+
     QTime now = QTime::currentTime();
     if (autoNightMode && now.hour() >= 20 && !nightMode) {
         nightMode = true;
@@ -56,21 +113,30 @@ MainWindow::MainWindow(QWidget *parent)
         info += QString("File Path: %1\n").arg(currentFilePath);
         info += QString("Page Count: %1\n").arg(pageCount);
 
-        if (pageCount > 0) {
-            ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, 0);
-            while (!ddjvu_page_decoding_done(page))
-                ddjvu_message_wait(ctx);
-
-            int width = ddjvu_page_get_width(page);
-            int height = ddjvu_page_get_height(page);
-            int dpi = ddjvu_page_get_resolution(page);
-            ddjvu_page_release(page);
-
-            info += QString("Page Size: %1 x %2 px\n").arg(width).arg(height);
-            info += QString("DPI: %1\n").arg(dpi);
+        ddjvu_page_t *page = pageCount > 0 ? ddjvu_page_create_by_pageno(doc, 0) : nullptr;
+        if (!page) {
+            QMessageBox::information(this, "DjVu File Info", info);
+            return;
         }
 
-        QMessageBox::information(this, "DjVu File Info", info);
+        // The first page is decoded without blocking the event loop. Opening
+        // another file meanwhile fails the wait, and the box isn't shown.
+        int serial = openSerial;
+        djvu.pageDecoded(page, doc).then(this, [this, serial, page, info](bool ok) mutable {
+            if (serial != openSerial) {
+                ddjvu_page_release(page);
+                return;
+            }
+            if (ok) {
+                int width = ddjvu_page_get_width(page);
+                int height = ddjvu_page_get_height(page);
+                int dpi = ddjvu_page_get_resolution(page);
+                info += QString("Page Size: %1 x %2 px\n").arg(width).arg(height);
+                info += QString("DPI: %1\n").arg(dpi);
+            }
+            ddjvu_page_release(page);
+            QMessageBox::information(this, "DjVu File Info", info);
+        });
     }, QKeySequence("Ctrl+I"));
 
 
@@ -82,6 +148,9 @@ MainWindow::MainWindow(QWidget *parent)
     fileMenu->addSeparator();
     fileMenu->addAction("Exit", this, &QWidget::close, QKeySequence("Ctrl+Q"));
 
+    QMenu *editMenu = menuBar->addMenu("Edit");
+    editMenu->addAction("Copy", this, &MainWindow::copySelection, QKeySequence("Ctrl+C"));
+
     QMenu *viewMenu = menuBar->addMenu("View");
     viewMenu->addAction("Zoom In", this, &MainWindow::zoomIn, QKeySequence("Ctrl++"));
     viewMenu->addAction("Zoom Out", this, &MainWindow::zoomOut, QKeySequence("Ctrl+-"));
@@ -91,6 +160,10 @@ MainWindow::MainWindow(QWidget *parent)
     connect(toggleThumbnailsAction, &QAction::toggled, this, [this](bool enabled) {
         showThumbnails = enabled;
         thumbList->setVisible(enabled);
+        if (enabled) {
+            selectCurrentThumbnail(true);
+            thumbnailTimer->start();
+        }
     });
     QAction *toggleNightMode = viewMenu->addAction("Night Mode");
     toggleNightMode->setCheckable(true);
@@ -103,7 +176,7 @@ MainWindow::MainWindow(QWidget *parent)
         settings.setValue("nightMode", nightMode);
 
         refreshThumbnails();
-        loadPage(currentPage);
+        reloadView();
     });
     viewMenu->addAction("Adjust Night Mode Warmth", this, [this]() {
         QDialog dialog(this);
@@ -127,8 +200,9 @@ MainWindow::MainWindow(QWidget *parent)
             warmthLevel = value;
             QSettings settings("MyCompany", "BookReader");
             settings.setValue("warmthLevel", warmthLevel);
+            refreshThumbnails();
             if (nightMode)
-                loadPage(currentPage);
+                scheduleReload();
         });
 
         connect(autoNightBox, &QCheckBox::toggled, this, [this](bool enabled) {
@@ -139,6 +213,122 @@ MainWindow::MainWindow(QWidget *parent)
 
         dialog.exec();
     });
+    QMenu *renderingMenu = viewMenu->addMenu("Rendering");
+    renderingMenu->addAction("Prefetch Distance", this, [this]() {
+        bool ok = false;
+        int pages = QInputDialog::getInt(this, "Prefetch Distance",
+                                         "Pages to render ahead of and behind the current page:",
+                                         renderService->prefetchDistance(), 0, 10, 1, &ok);
+        if (!ok)
+            return;
+
+        renderService->setPrefetchDistance(pages);
+        QSettings settings("MyCompany", "BookReader");
+        settings.setValue("prefetchPages", pages);
+        reloadView();
+    });
+    renderingMenu->addAction("Page Cache Size", this, [this]() {
+        bool ok = false;
+        int megabytes = QInputDialog::getInt(this, "Page Cache Size",
+                                             "Memory for rendered pages (MB):",
+                                             static_cast<int>(renderService->cacheStats().budget / (1024 * 1024)),
+                                             16, 8192, 16, &ok);
+        if (!ok)
+            return;
+
+        renderService->setCacheBudget(static_cast<qint64>(megabytes) * 1024 * 1024);
+        QSettings settings("MyCompany", "BookReader");
+        settings.setValue("renderCacheMB", megabytes);
+    });
+    renderingMenu->addAction("Page Cache Statistics", this, [this]() {
+        PageCache::Stats stats = renderService->cacheStats();
+        qint64 lookups = stats.hits + stats.misses;
+
+        QString info;
+        info += QString("Hits: %1\n").arg(stats.hits);
+        info += QString("Misses: %1\n").arg(stats.misses);
+        info += QString("Hit Rate: %1%\n").arg(lookups > 0 ? 100.0 * stats.hits / lookups : 0.0, 0, 'f', 1);
+        info += QString("Evictions: %1\n").arg(stats.evictions);
+        info += QString("Cached Pages: %1\n").arg(stats.entries);
+        info += QString("Memory: %1 of %2 MB\n").arg(stats.bytes / (1024 * 1024)).arg(stats.budget / (1024 * 1024));
+
+        DjvuPagePool::Stats decoded = renderService->decodedPageStats();
+        info += "\nDecoded DjVu Pages\n";
+        info += QString("Reused: %1\n").arg(decoded.hits);
+        info += QString("Decoded: %1 (%2 ms)\n").arg(decoded.misses).arg(decoded.decodeNanoseconds / 1000000);
+        info += QString("Decode Time Saved: %1 ms\n").arg(decoded.savedNanoseconds / 1000000);
+        info += QString("Kept: %1 of %2 pages\n").arg(decoded.entries).arg(decoded.capacity);
+        info += QString("DjVu Decode Cache: %1 MB\n").arg(djvu.cacheSize() / (1024 * 1024));
+
+        QMessageBox::information(this, "Page Cache Statistics", info);
+    });
+    renderingMenu->addAction("Decoded Pages Kept", this, [this]() {
+        bool ok = false;
+        int pages = QInputDialog::getInt(this, "Decoded Pages Kept",
+                                         "DjVu pages kept decoded for re-rendering at another zoom:",
+                                         renderService->decodedPageStats().capacity, 1, 64, 1, &ok);
+        if (!ok)
+            return;
+
+        renderService->setDecodedPageCount(pages);
+        QSettings settings("MyCompany", "BookReader");
+        settings.setValue("decodedPages", pages);
+    });
+    renderingMenu->addAction("DjVu Decode Cache Size", this, [this]() {
+        bool ok = false;
+        int megabytes = QInputDialog::getInt(this, "DjVu Decode Cache Size",
+                                             QString("Memory for decoded DjVu data (MB).\n"
+                                                     "Suggested for this machine: %1 MB:")
+                                                 .arg(DjvuBackend::defaultCacheSize() / (1024 * 1024)),
+                                             static_cast<int>(djvu.cacheSize() / (1024 * 1024)),
+                                             1, 4096, 16, &ok);
+        if (!ok)
+            return;
+
+        djvu.setCacheSize(static_cast<qint64>(megabytes) * 1024 * 1024);
+        QSettings settings("MyCompany", "BookReader");
+        settings.setValue("djvuCacheMB", megabytes);
+    });
+    renderingMenu->addAction("Thumbnail Disk Cache Size", this, [this]() {
+        bool ok = false;
+        int megabytes = QInputDialog::getInt(this, "Thumbnail Disk Cache Size",
+                                             QString("Disk space for thumbnails of recently opened documents (MB).\n"
+                                                     "Currently using %1 MB; 0 clears the cache:")
+                                                 .arg(thumbnailDiskCache.diskUsage() / (1024 * 1024)),
+                                             static_cast<int>(thumbnailDiskCache.budget() / (1024 * 1024)),
+                                             0, 65536, 64, &ok);
+        if (!ok)
+            return;
+
+        if (megabytes == 0)
+            thumbnailDiskCache.clear();
+        thumbnailDiskCache.setBudget(static_cast<qint64>(megabytes) * 1024 * 1024);
+        QSettings settings("MyCompany", "BookReader");
+        settings.setValue("thumbnailCacheMB", megabytes);
+    });
+    renderingMenu->addAction("Thumbnail Statistics", this, [this]() {
+        static const char *const names[ThumbnailModel::SourceCount] = {"Disk cache", "Embedded", "Rendered"};
+        ThumbnailModel::Stats stats = thumbnailModel->sourceStats();
+        PageCache::Stats memory = thumbnailModel->cacheStats();
+
+        QString info;
+        for (int i = 0; i < ThumbnailModel::SourceCount; ++i) {
+            double average = stats.pages[i] > 0 ? stats.nanoseconds[i] / 1e6 / stats.pages[i] : 0.0;
+            info += QString("%1: %2 pages, %3 ms each\n").arg(names[i]).arg(stats.pages[i]).arg(average, 0, 'f', 2);
+        }
+        info += QString("In memory: %1 thumbnails, %2 of %3 KB\n")
+                    .arg(memory.entries).arg(memory.bytes / 1024).arg(memory.budget / 1024);
+        info += "\nHover a thumbnail to see where it came from.";
+
+        QMessageBox::information(this, "Thumbnail Statistics", info);
+    });
+    renderingMenu->addAction("Open Statistics", this, [this]() {
+        QString info = openLog.isEmpty() ? QString("No documents opened yet.\n") : openLog.join("\n") + "\n";
+        qint64 resident = residentMemory();
+        if (resident >= 0)
+            info += QString("\nResident memory now: %1 MB").arg(resident / (1024 * 1024));
+        QMessageBox::information(this, "Open Statistics", info);
+    });
 
 
     viewMenu->addSeparator();
@@ -160,7 +350,6 @@ MainWindow::MainWindow(QWidget *parent)
     normalSizeAction->setShortcut(QKeySequence("Ctrl+0"));
     connect(normalSizeAction, &QAction::triggered, this, [this]() {
         fitToWindow = true;
-        scrollArea->setWidgetResizable(true);
         loadPage(currentPage);
         qDebug() << "Normal Size triggered";
     });
@@ -203,7 +392,6 @@ MainWindow::MainWindow(QWidget *parent)
     connect(toggleFullScreenAction, &QAction::triggered, this, [this]() {
         isFullScreen = !isFullScreen;
         fitToWindow = true;
-        scrollArea->setWidgetResizable(true);
         if (isFullScreen)
             showFullScreen();
         else
@@ -244,15 +432,27 @@ MainWindow::MainWindow(QWidget *parent)
             loadPage(page);
     });
 
-    scrollArea = new QScrollArea;
-    imageLabel = new ImageLabel;
-    imageLabel->setText("Open a file");
-    imageLabel->setAlignment(Qt::AlignCenter);
-    imageLabel->setStyleSheet("background-color: #1a1a1a;");
-    static_cast<ImageLabel *>(imageLabel)->setScrollArea(scrollArea);
-    scrollArea->setWidget(imageLabel);
-    scrollArea->setWidgetResizable(fitToWindow); // true or false depending on mode
-    imageLabel->adjustSize();
+    pageView = new PageView(renderService);
+    pageView->clear("Open a file");
+    connect(pageView, &PageView::currentPageChanged, this, [this](int pageNum) {
+        if (!continuousScrollMode || pageNum == currentPage)
+            return;
+        currentPage = pageNum;
+        updatePageIndicators();
+    });
+    connect(pageView, &PageView::pageShown, this, [this](int pageNum) {
+        if (!firstPixelPending || pageNum != currentPage)
+            return;
+        firstPixelPending = false;
+        logOpenStage("first pixel");
+        statusBar()->showMessage(QString("First page shown after %1 ms").arg(openClock.nsecsElapsed() / 1e6, 0, 'f', 1), 5000);
+    });
+    connect(pageView, &PageView::selectionChanged, this, [this](int pageNum, const QRectF &rect) {
+        selectionPage = pageNum;
+        selectionRect = rect;
+        textIndex->prioritize(pageNum);
+        updateSelection();
+    });
 
     // === Controls ===
     QPushButton *openBtn = new QPushButton("Open");
@@ -267,11 +467,23 @@ MainWindow::MainWindow(QWidget *parent)
     pageInput->setMaximum(1);
 
     searchResultsList = new QListWidget;
-    searchResultsList->setFixedWidth(220);
-    searchResultsList->hide(); // hidden by default
+    searchStatusLabel = new QLabel;
+    searchStatusLabel->setWordWrap(true);
+    searchProgress = new QProgressBar;
+    searchProgress->setTextVisible(false);
+    searchProgress->hide();
+
+    searchPanel = new QWidget;
+    QVBoxLayout *searchLayout = new QVBoxLayout(searchPanel);
+    searchLayout->setContentsMargins(0, 0, 0, 0);
+    searchLayout->addWidget(searchStatusLabel);
+    searchLayout->addWidget(searchProgress);
+    searchLayout->addWidget(searchResultsList);
+    searchPanel->setFixedWidth(220);
+    searchPanel->hide(); // hidden by default
 
     QHBoxLayout *btnLayout = new QHBoxLayout;
-    btnLayout->addSpacerItem(new QSpacerItem(scrollArea->width()/5, 0, QSizePolicy::Fixed));
+    btnLayout->addSpacerItem(new QSpacerItem(pageView->width()/5, 0, QSizePolicy::Fixed));
     btnLayout->addWidget(prevBtn);
     btnLayout->addWidget(openBtn);
     btnLayout->addWidget(nextBtn);
@@ -279,16 +491,27 @@ MainWindow::MainWindow(QWidget *parent)
     btnLayout->addWidget(zoomInBtn);
     btnLayout->addWidget(pageLabel);
     btnLayout->addWidget(pageInput);
-    btnLayout->addSpacerItem(new QSpacerItem(scrollArea->width()/5, 0, QSizePolicy::Fixed));
-    thumbList = new QListWidget;
-    thumbList->setIconSize(QSize(80, 100));
+    btnLayout->addSpacerItem(new QSpacerItem(pageView->width()/5, 0, QSizePolicy::Fixed));
+    // Uniform item sizes let the view place rows without asking the model
+    // about each one, which matters with thousands of pages.
+    thumbnailModel = new ThumbnailModel(16ll * 1024 * 1024, this);
+    thumbList = new QListView;
+    thumbList->setModel(thumbnailModel);
+    thumbList->setIconSize(ThumbnailModel::ThumbnailSize);
     thumbList->setFixedWidth(100);
     thumbList->setResizeMode(QListView::Adjust);
-    thumbList->setViewMode(QListView::IconMode);
     thumbList->setMovement(QListView::Static);
+    thumbList->setUniformItemSizes(true);
     thumbList->setSpacing(5);
     thumbList->hide();
 
+    thumbnailTimer = new QTimer(this);
+    thumbnailTimer->setSingleShot(true);
+    thumbnailTimer->setInterval(30);
+    connect(thumbnailTimer, &QTimer::timeout, this, &MainWindow::requestVisibleThumbnails);
+    connect(thumbList->verticalScrollBar(), &QScrollBar::valueChanged, thumbnailTimer, qOverload<>(&QTimer::start));
+    connect(thumbList->verticalScrollBar(), &QScrollBar::rangeChanged, thumbnailTimer, qOverload<>(&QTimer::start));
+
     QShortcut *shortcut = new QShortcut(QKeySequence("Ctrl+F"), this);
 
     connect(shortcut, &QShortcut::activated, this, [this]() {
@@ -318,6 +541,10 @@ MainWindow::MainWindow(QWidget *parent)
                 }
             });
 
+            // Editing the query or closing the dialog stops a running search.
+            connect(searchDialog, &SearchDialog::queryChanged, this, &MainWindow::cancelSearchAll);
+            connect(searchDialog, &QDialog::rejected, this, &MainWindow::cancelSearchAll);
+
             connect(searchDialog, &SearchDialog::searchAll, this, [this]() {
                 QString text = searchDialog->searchText().trimmed();
                 if (!text.isEmpty()) {
@@ -333,12 +560,12 @@ MainWindow::MainWindow(QWidget *parent)
     });
 
     QVBoxLayout *rightLayout = new QVBoxLayout;
-    rightLayout->addWidget(scrollArea);
+    rightLayout->addWidget(pageView);
     rightLayout->addLayout(btnLayout);
 
     QHBoxLayout *mainLayout = new QHBoxLayout;
     mainLayout->addWidget(thumbList);
-    mainLayout->addWidget(searchResultsList);  // Left of document view
+    mainLayout->addWidget(searchPanel);  // Left of document view
     mainLayout->addWidget(outlineTree);
     mainLayout->addLayout(rightLayout);
 
@@ -364,7 +591,9 @@ MainWindow::MainWindow(QWidget *parent)
     };
     connect(pageInput, &QSpinBox::editingFinished, this, goToPage);
 
-    connect(thumbList, &QListWidget::currentRowChanged, this, [this](int index) {
+    connect(thumbList->selectionModel(), &QItemSelectionModel::currentChanged, this,
+            [this](const QModelIndex &current) {
+        int index = current.row();
         if (index >= 0 && index < pageCount && index != currentPage)
             loadPage(index);
     });
@@ -373,12 +602,23 @@ MainWindow::MainWindow(QWidget *parent)
         int page = item->data(Qt::UserRole).toInt();
         loadPage(page);
     });
+
+    // Night mode may already be on from the settings or the time of day.
+    refreshThumbnails();
 }
 
 MainWindow::~MainWindow() {
     saveLastReadState();
-    if (doc) ddjvu_document_release(doc);
-    if (ctx) ddjvu_context_release(ctx);
+    ++openSerial;
+    delete pdfExporter;
+    openPool.waitForDone();
+    stopThumbnailWorker();
+    textIndex->clear();
+    renderService->clearDocument();
+    if (doc) {
+        djvu.forgetDocument(doc);
+        ddjvu_document_release(doc);
+    }
 }
 
 void MainWindow::openFile() {
@@ -401,20 +641,99 @@ void MainWindow::openFile() {
     setWindowTitle(tr("Book Reader") + " - " +QFileInfo(filePath).fileName());
 }
 
+void MainWindow::logOpen(const QString &filePath, qint64 elapsedNanoseconds, qint64 residentBefore)
+{
+    qint64 residentAfter = residentMemory();
+    QString entry = QString("%1: header %2 ms").arg(QFileInfo(filePath).fileName())
+                        .arg(elapsedNanoseconds / 1e6, 0, 'f', 1);
+    if (residentBefore >= 0 && residentAfter >= 0)
+        entry += QString(", resident memory %1%2 MB").arg(residentAfter >= residentBefore ? "+" : "")
+                     .arg((residentAfter - residentBefore) / (1024.0 * 1024.0), 0, 'f', 1);
+
+    openLog.append(entry);
+    while (openLog.size() > 20)
+        openLog.removeFirst();
+    statusBar()->showMessage("Opened " + entry, 5000);
+}
+
+void MainWindow::beginOpen(const QString &filePath)
+{
+    ++openSerial;
+    openClock.start();
+    openResidentBefore = residentMemory();
+    firstPixelPending = false;
+    textIndexPending = false;
+
+    stopThumbnailWorker();
+    cancelSearchAll();
+    searchPanel->hide();
+    textIndex->clear();
+    highlightWaitPage = -1;
+    searchWaitPage = -1;
+    selectionPage = -1;
+    selectedWords.clear();
+    pageView->clearSelection();
+    renderService->clearDocument();
+    outlineTree->clear();
+    outlineTree->hide();
+
+    // Nothing can be shown or navigated until the header is parsed.
+    pageCount = 0;
+    pageView->clear("Opening " + QFileInfo(filePath).fileName() + "...");
+}
+
+void MainWindow::logOpenStage(const QString &stage)
+{
+    QString entry = QString("    %1: %2 ms").arg(stage).arg(openClock.nsecsElapsed() / 1e6, 0, 'f', 1);
+    openLog.append(entry);
+    while (openLog.size() > 20)
+        openLog.removeFirst();
+}
+
 void MainWindow::openDjvuFile(const QString &filePath) {
-    if (doc) ddjvu_document_release(doc);
+    beginOpen(filePath);
+    if (doc) {
+        djvu.forgetDocument(doc);
+        ddjvu_document_release(doc);
+    }
+
+    // libdjvu reads the file on demand as pages are decoded.
     doc = ddjvu_document_create_by_filename(ctx, filePath.toUtf8().data(), TRUE);
-    while (!ddjvu_document_decoding_done(doc)) {
-        ddjvu_message_wait(ctx);
+    if (!doc) {
+        finishDjvuOpen(filePath);
+        return;
     }
 
-    pageCount = ddjvu_document_get_pagenum(doc);
+    // The directory is decoded while the event loop keeps running.
+    int serial = openSerial;
+    djvu.documentDecoded(doc).then(this, [this, serial, filePath](bool) {
+        if (serial == openSerial)
+            finishDjvuOpen(filePath);
+    });
+}
+
+void MainWindow::finishDjvuOpen(const QString &filePath) {
+    pageCount = doc && !ddjvu_document_decoding_error(doc) ? ddjvu_document_get_pagenum(doc) : 0;
+    logOpen(filePath, openClock.nsecsElapsed(), openResidentBefore);
     if (pageCount <= 0) {
+        pageView->clear("Open a file");
         QMessageBox::warning(this, "Error", "Failed to open DjVu file or no pages found.");
         thumbList->hide(); // Hide it if loading failed
         return;
     }
 
+    renderService->setDjvuDocument(doc, filePath, pageCount);
+    showOpenedDocument(filePath);
+
+    QString cacheDirectory = thumbnailDiskCache.documentDirectory(filePath);
+    startThumbnailWorker(new DjvuThumbnailWorker(&djvu, filePath, cacheDirectory, this));
+    textIndexPending = true;
+    textIndex->setDjvuDocument(&djvu, filePath, pageCount,
+                               cacheDirectory.isEmpty() ? QString() : cacheDirectory + "/text.index");
+}
+
+void MainWindow::showOpenedDocument(const QString &filePath)
+{
     // Update recent files
     QSettings settings("MyCompany", "BookReader");
     QStringList list = settings.value("recentFiles").toStringList();
@@ -428,63 +747,23 @@ void MainWindow::openDjvuFile(const QString &filePath) {
     currentPage = 0;
     zoom = 1.0;
     fitToWindow = true;
+    loadLastReadState(filePath);
+    currentPage = std::clamp(currentPage, 0, pageCount - 1);
+    refreshThumbnails(); // the document may restore its own night mode
 
     pageInput->setMaximum(pageCount);
+    thumbnailModel->setPageCount(pageCount);
 
-    loadLastReadState(currentFilePath);
-
-    thumbList->blockSignals(true);
-    thumbList->clear();
-    thumbList->blockSignals(false);
-
-    thumbnails.clear();
-    originalThumbnails.clear();
-
-    if (!showThumbnails) {
-        thumbList->hide();
-    } else {
-        for (int i = 0; i < pageCount; ++i) {
-            ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, i);
-            while (!ddjvu_page_decoding_done(page))
-                ddjvu_message_wait(ctx);
-
-            int w = ddjvu_page_get_width(page);
-            int h = ddjvu_page_get_height(page);
-            double thumbScale = 80.0 / w;
-            int tw = static_cast<int>(w * thumbScale);
-            int th = static_cast<int>(h * thumbScale);
-
-            ddjvu_rect_t rrect = {0, 0, static_cast<unsigned int>(tw), static_cast<unsigned int>(th)};
-            ddjvu_format_t *fmt = ddjvu_format_create(DDJVU_FORMAT_RGB24, 0, nullptr);
-            ddjvu_format_set_row_order(fmt, 1);
-            QByteArray buffer(tw * th * 3, 0);
-            ddjvu_page_render(page, DDJVU_RENDER_COLOR, &rrect, &rrect, fmt, tw * 3, buffer.data());
-            ddjvu_format_release(fmt);
-
-            QImage thumbImg((uchar *)buffer.data(), tw, th, tw * 3, QImage::Format_RGB888);
-
-            if (nightMode)
-                thumbImg = applyNightMode(thumbImg);
-
-            thumbnails.push_back(thumbImg.copy());
-            originalThumbnails.push_back(thumbImg.copy());
-
-            QListWidgetItem *item = new QListWidgetItem(QIcon(QPixmap::fromImage(thumbnails[i])), "");
-            thumbList->addItem(item);
-
-            ddjvu_page_release(page);
-        }
-        thumbList->blockSignals(false);
-        thumbList->setCurrentRow(0);
-        // enableContinuousScroll(false);
-        // enableFacingPages(false);
-    }
-
-    loadLastReadState(currentFilePath);
+    // The restored page goes up before anything else is started; the page
+    // view reports when its first pixels are on screen.
+    firstPixelPending = true;
+    if (continuousScrollMode || facingPagesMode)
+        reloadView();
+    else
+        loadPage(currentPage);
 
-    loadSinglePage();
-    if (showThumbnails)
-        thumbList->show();
+    thumbList->setVisible(showThumbnails);
+    selectCurrentThumbnail(true);
 
     if (centralWidget())
         centralWidget()->setFocus(Qt::OtherFocusReason);
@@ -497,112 +776,130 @@ void MainWindow::loadPage(int pageNum)
 
     currentPage = pageNum;
 
-    QImage image;
-    if (isPdf) {
-        double scale = fitToWindow ? scrollArea->viewport()->width() / 800.0 : zoom;
-        image = renderPdfPage(pageNum, scale);
-
-        if (!lastSearchText.isEmpty()) {
-            auto page = pdfDoc->page(pageNum);
-            if (page) {
-                std::vector<std::unique_ptr<Poppler::TextBox>> boxes = page->textList();
-                QPainter painter(&image);
-                painter.setPen(Qt::NoPen);
-                painter.setBrush(QColor(255, 255, 0, 128)); // semi-transparent yellow
-
-                for (const auto& box : boxes) {
-                    if (box->text().contains(lastSearchText, Qt::CaseInsensitive)) {
-                        QRectF rect = box->boundingBox();
-                        QRect scaledRect(
-                            int(rect.left() * image.width() / page->pageSizeF().width()),
-                            int(rect.top() * image.height() / page->pageSizeF().height()),
-                            int(rect.width() * image.width() / page->pageSizeF().width()),
-                            int(rect.height() * image.height() / page->pageSizeF().height())
-                            );
-                        painter.drawRoundedRect(scaledRect, 3, 3);
-                    }
-                }
-                painter.end();
-            }
-        }
-
-    } else {
-        ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, pageNum);
-        while (!ddjvu_page_decoding_done(page))
-            ddjvu_message_wait(ctx);
-        image = renderPage(page, -1);
-        if (nightMode && !image.isNull()) {
-            image = applyNightMode(image);
-        }
-        ddjvu_page_release(page);
-    }
-
-    if (imageLabel) {
-        scrollArea->takeWidget();
-        delete imageLabel;
-        imageLabel = nullptr;
+    if (continuousScrollMode) {
+        pageView->scrollToPage(pageNum);
+        updatePageIndicators();
+        return;
     }
 
-    imageLabel = new ImageLabel;
-    imageLabel->setPixmap(QPixmap::fromImage(image));
-    imageLabel->resize(image.size());
-    imageLabel->setAlignment(Qt::AlignCenter);
-    imageLabel->setStyleSheet("background-color: #1a1a1a;");
-    imageLabel->setScrollArea(scrollArea);
-
-    scrollArea->setWidget(imageLabel);
-    scrollArea->setWidgetResizable(fitToWindow);
+    // Pages are rendered on the render service's workers; the page view
+    // paints whatever is ready and fills the rest in as renders arrive.
+    RenderParams params = currentRenderParams();
+    QSize fullSize = renderService->pageDisplaySize(pageNum, params);
+    QSize viewportPixels = params.viewportSize * params.devicePixelRatio;
+    bool tiled = !fitToWindow && (fullSize.width() > viewportPixels.width()
+                                  || fullSize.height() > viewportPixels.height());
+    pageView->showSinglePage(pageNum, params, tiled);
+    pageView->setHighlights(pageNum, searchHighlights(pageNum));
+    if (!tiled)
+        renderService->requestPage(pageNum, params);
+
+    updatePageIndicators();
+    if (centralWidget())
+        centralWidget()->setFocus(Qt::OtherFocusReason);
+}
 
+void MainWindow::updatePageIndicators()
+{
     pageLabel->setText(QString("Page %1 of %2").arg(currentPage + 1).arg(pageCount));
 
     pageInput->blockSignals(true);
     pageInput->setValue(currentPage + 1);
     pageInput->blockSignals(false);
 
-    if (showThumbnails) {
-        thumbList->blockSignals(true);
-        thumbList->setCurrentRow(currentPage);
-        thumbList->blockSignals(false);
-    }
+    if (showThumbnails)
+        selectCurrentThumbnail(false);
+}
 
-    if (centralWidget())
-        centralWidget()->setFocus(Qt::OtherFocusReason);
+void MainWindow::reloadView()
+{
+    if (continuousScrollMode)
+        enableContinuousScroll(true);
+    else if (facingPagesMode)
+        enableFacingPages(true);
+    else
+        loadPage(currentPage);
 }
 
-QImage MainWindow::renderPage(ddjvu_page_t *page, double customScale) {
-    int origWidth = ddjvu_page_get_width(page);
-    int origHeight = ddjvu_page_get_height(page);
-
-    double scale;
-    if (customScale > 0) {
-        scale = customScale;
-        qDebug() << "[renderPage] customScale =" << scale;
-    } else if (fitToWindow) {
-        QSize areaSize = scrollArea->viewport()->size();
-        double scaleW = static_cast<double>(areaSize.width()) / origWidth;
-        double scaleH = static_cast<double>(areaSize.height()) / origHeight;
-        scale = std::min(scaleW, scaleH);
-        qDebug() << "[renderPage] fitToWindow scale =" << scale;
-    } else {
-        QSize areaSize = scrollArea->viewport()->size();
-        double scaleW = static_cast<double>(areaSize.width()) / origWidth;
-        double scaleH = static_cast<double>(areaSize.height()) / origHeight;
-        scale = std::min(scaleW*zoom, scaleH*zoom);
+QVector<QRectF> MainWindow::searchHighlights(int pageNum)
+{
+    if (lastSearchText.isEmpty())
+        return QVector<QRectF>();
+
+    if (!textIndex->hasPage(pageNum)) {
+        highlightWaitPage = pageNum;
+        textIndex->prioritize(pageNum);
+        return QVector<QRectF>();
     }
+    return textIndex->matchBoxes(pageNum, TextIndex::fold(lastSearchText));
+}
 
-    int width = static_cast<int>(origWidth * scale);
-    int height = static_cast<int>(origHeight * scale);
+void MainWindow::onPageIndexed(int pageNum)
+{
+    if (pageNum == highlightWaitPage) {
+        highlightWaitPage = -1;
+        if (pageNum == currentPage)
+            pageView->setHighlights(pageNum, searchHighlights(pageNum));
+    }
+    if (pageNum == selectionPage)
+        updateSelection();
+    if (pageNum == searchWaitPage) {
+        searchWaitPage = -1;
+        statusBar()->clearMessage();
+        if (searchWaitForward)
+            searchNext(lastSearchText);
+        else
+            searchPrevious(lastSearchText);
+    }
+}
+
+void MainWindow::updateSelection()
+{
+    std::shared_ptr<const TextLayer> layer = textIndex->layer(selectionPage);
+    selectedWords = layer ? layer->wordsIn(selectionRect) : QVector<int>();
+    pageView->setSelection(selectionPage, layer ? layer->boxes(selectedWords) : QVector<QRectF>());
+}
+
+void MainWindow::copySelection()
+{
+    std::shared_ptr<const TextLayer> layer = textIndex->layer(selectionPage);
+    if (!layer || selectedWords.isEmpty())
+        return;
+
+    QGuiApplication::clipboard()->setText(layer->text(selectedWords));
+    statusBar()->showMessage(QString("Copied %1 words").arg(selectedWords.size()), 2000);
+}
 
-    qDebug() << "[renderPage] final image size =" << width << "x" << height;
+RenderParams MainWindow::currentRenderParams() const
+{
+    RenderParams params;
+    params.viewportSize = pageView->viewport()->size();
+    params.devicePixelRatio = pageView->devicePixelRatioF();
+    params.fitToWindow = fitToWindow;
+    params.zoom = zoom;
+    params.nightMode = nightMode;
+    params.warmthLevel = warmthLevel;
+    return params;
+}
 
-    ddjvu_rect_t rrect = {0, 0, static_cast<unsigned int>(width), static_cast<unsigned int>(height)};
-    ddjvu_format_t *fmt = ddjvu_format_create(DDJVU_FORMAT_RGB24, 0, nullptr);
-    ddjvu_format_set_row_order(fmt, 1);
-    QByteArray buffer(width * height * 3, 0);
-    ddjvu_page_render(page, DDJVU_RENDER_COLOR, &rrect, &rrect, fmt, width * 3, buffer.data());
-    ddjvu_format_release(fmt);
+RenderParams MainWindow::facingRenderParams() const
+{
+    // Each page of the spread fits half of the viewport.
+    RenderParams params = currentRenderParams();
+    params.viewportSize.setWidth(params.viewportSize.width() / 2);
+    params.fitToWindow = true;
+    params.zoom = 1.0;
+    return params;
+}
 
-    return QImage((uchar *)buffer.data(), width, height, width * 3, QImage::Format_RGB888).copy();
+RenderParams MainWindow::continuousRenderParams() const
+{
+    RenderParams params = currentRenderParams();
+    params.viewportSize.setWidth(params.viewportSize.width() - 20);
+    params.fitToWindow = true;
+    params.fitWidth = true;
+    params.zoom = 1.0;
+    return params;
 }
 
 
@@ -632,56 +929,48 @@ void MainWindow::zoomIn() {
     fitToWindow = false;
     if (fitToWindowAction)
         fitToWindowAction->setChecked(false);
-    // scrollArea->setWidgetResizable(false);
 
     // Store center position
-    QPoint centerBefore = scrollArea->viewport()->rect().center();
-    QPointF ratioCenter(
-        static_cast<double>(scrollArea->horizontalScrollBar()->value() + centerBefore.x()) / scrollArea->widget()->width(),
-        static_cast<double>(scrollArea->verticalScrollBar()->value() + centerBefore.y()) / scrollArea->widget()->height()
-        );
+    QPointF ratioCenter = pageView->centerRatio();
 
     zoom *= 1.1;
     loadPage(currentPage);
-
-    int hVal = static_cast<int>(scrollArea->widget()->width() * ratioCenter.x()) - scrollArea->viewport()->width() / 2;
-    int vVal = static_cast<int>(scrollArea->widget()->height() * ratioCenter.y()) - scrollArea->viewport()->height() / 2;
-    scrollArea->horizontalScrollBar()->setValue(hVal);
-    scrollArea->verticalScrollBar()->setValue(vVal);
+    pageView->setCenterRatio(ratioCenter);
 }
 
 void MainWindow::zoomOut() {
     fitToWindow = false;
     if (fitToWindowAction)
         fitToWindowAction->setChecked(false);
-    scrollArea->setWidgetResizable(false);
 
     // Store center
-    QPoint centerBefore = scrollArea->viewport()->rect().center();
-    QPointF ratioCenter(
-        static_cast<double>(scrollArea->horizontalScrollBar()->value() + centerBefore.x()) / scrollArea->widget()->width(),
-        static_cast<double>(scrollArea->verticalScrollBar()->value() + centerBefore.y()) / scrollArea->widget()->height()
-        );
+    QPointF ratioCenter = pageView->centerRatio();
 
     zoom /= 1.1;
     loadPage(currentPage);
-
-    int hVal = static_cast<int>(scrollArea->widget()->width() * ratioCenter.x()) - scrollArea->viewport()->width() / 2;
-    int vVal = static_cast<int>(scrollArea->widget()->height() * ratioCenter.y()) - scrollArea->viewport()->height() / 2;
-    scrollArea->horizontalScrollBar()->setValue(hVal);
-    scrollArea->verticalScrollBar()->setValue(vVal);
+    pageView->setCenterRatio(ratioCenter);
 }
 
 void MainWindow::resizeEvent(QResizeEvent *event) {
     QMainWindow::resizeEvent(event);
     if (fitToWindow)
-        loadPage(currentPage);
+        scheduleReload();
+}
+
+void MainWindow::scheduleReload() {
+    reloadTimer->start();
 }
 
 void MainWindow::keyPressEvent(QKeyEvent *event) {
     if (event->key() == Qt::Key_Escape && searchDialog && searchDialog->isVisible()) {
         searchDialog->setVisible(false);
         lastSearchText.clear();
+        cancelSearchAll();
+        return;
+    }
+
+    if (event->key() == Qt::Key_Escape && !searchAllQuery.isEmpty()) {
+        cancelSearchAll();
         return;
     }
 
@@ -694,11 +983,11 @@ void MainWindow::keyPressEvent(QKeyEvent *event) {
 
     if (event->key() == Qt::Key_Space) {
         if (continuousScrollMode) {
-            int delta = scrollArea->viewport()->height();
+            int delta = pageView->viewport()->height();
             if (event->modifiers() & Qt::ShiftModifier)
                 delta = -delta;
 
-            QScrollBar *vScroll = scrollArea->verticalScrollBar();
+            QScrollBar *vScroll = pageView->verticalScrollBar();
             vScroll->setValue(vScroll->value() + delta);
         } else {
             if (event->modifiers() & Qt::ShiftModifier)
@@ -799,134 +1088,92 @@ void MainWindow::applyTheme(Theme theme) {
     }
 }
 
-void MainWindow::loadSinglePage()
-{
-    if ( scrollArea->isEnabled() && imageLabel->isEnabled() )
-    {
-        scrollArea->takeWidget();
-        scrollArea->setWidget(imageLabel);
-        scrollArea->setWidgetResizable(true);
-        loadPage(currentPage);
-    }
-}
-
 void MainWindow::refreshThumbnails() {
-    if (!showThumbnails || originalThumbnails.isEmpty()) return;
-
-    thumbList->blockSignals(true);
-    thumbList->clear();
-    thumbnails.clear();
-
-    for (int i = 0; i < originalThumbnails.size(); ++i) {
-        QImage img = nightMode ? applyNightMode(originalThumbnails[i]) : originalThumbnails[i];
-        thumbnails.push_back(img);
+    // Cached thumbnails are converted as they are painted; rows without one
+    // are rendered once they come into view.
+    thumbnailModel->setNightMode(nightMode, warmthLevel);
+}
 
-        QListWidgetItem *item = new QListWidgetItem(QIcon(QPixmap::fromImage(img)), "");
-        thumbList->addItem(item);
-    }
+void MainWindow::startThumbnailWorker(ThumbnailThread *worker) {
+    int serial = ++thumbnailSerial;
+    connect(worker, &ThumbnailThread::thumbnailReady, this,
+            [this, serial](int i, QImage image, int source, qint64 elapsed) {
+        if (serial == thumbnailSerial)
+            thumbnailModel->setThumbnail(i, image, static_cast<ThumbnailModel::Source>(source), elapsed);
+    });
+    connect(worker, &QThread::finished, worker, &QObject::deleteLater);
 
-    thumbList->setCurrentRow(currentPage);
-    thumbList->scrollToItem(thumbList->currentItem(), QAbstractItemView::PositionAtCenter);
-    thumbList->blockSignals(false);
+    thumbnailWorker = worker;
+    worker->start(QThread::LowPriority);
+    thumbnailTimer->start();
 }
 
-QImage MainWindow::applyNightMode(const QImage &input) {
-    QImage img = input.convertToFormat(QImage::Format_ARGB32);
-    for (int y = 0; y < img.height(); ++y) {
-        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
-        for (int x = 0; x < img.width(); ++x) {
-            QColor color = QColor::fromRgb(line[x]);
-
-            int h, s, v;
-            color.getHsv(&h, &s, &v);
+void MainWindow::stopThumbnailWorker() {
+    ++thumbnailSerial;
+    if (!thumbnailWorker)
+        return;
 
-            // Invert brightness
-            v = 255 - v;
+    // Renders in progress poll the stop flag, so this doesn't wait out a page.
+    thumbnailWorker->stop();
+    thumbnailWorker->wait();
+    thumbnailWorker = nullptr;
+}
 
-            // Add warmth by shifting hue slightly toward red/yellow
-            h = (h + warmthLevel) % 360;
+void MainWindow::requestVisibleThumbnails() {
+    if (!thumbnailWorker || !thumbList->isVisible() || pageCount <= 0)
+        return;
 
-            QColor newColor;
-            newColor.setHsv(h, s, v);
-            line[x] = newColor.rgba();
+    // With uniform item sizes visualRect() is cheap, so bisect for the first
+    // row that reaches down to y.
+    auto rowAt = [this](int y) {
+        int low = 0, high = pageCount - 1;
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (thumbList->visualRect(thumbnailModel->index(mid)).bottom() < y)
+                low = mid + 1;
+            else
+                high = mid;
         }
+        return low;
+    };
+
+    QRect area = thumbList->viewport()->rect();
+    int first = rowAt(area.top());
+    int last = rowAt(area.bottom());
+    int margin = last - first + 1;
+
+    QVector<int> rows;
+    for (int i = first; i <= last; ++i)
+        rows.append(i);
+    for (int i = 1; i <= margin; ++i) {
+        if (last + i < pageCount)
+            rows.append(last + i);
+        if (first - i >= 0)
+            rows.append(first - i);
     }
-    return img;
+    thumbnailWorker->request(thumbnailModel->missing(rows));
+}
+
+void MainWindow::selectCurrentThumbnail(bool center) {
+    thumbList->setCurrentIndex(thumbnailModel->index(currentPage));
+    if (center)
+        thumbList->scrollTo(thumbList->currentIndex(), QAbstractItemView::PositionAtCenter);
 }
 
 void MainWindow::enableContinuousScroll(bool enabled) {
     continuousScrollMode = enabled;
 
     if (!enabled) {
-        scrollArea->takeWidget();
-        scrollArea->setWidget(imageLabel);
-        scrollArea->setWidgetResizable(true);
         loadPage(currentPage);
         return;
     }
 
-    multiPageWidget = new QWidget;
-    multiPageLayout = new QVBoxLayout(multiPageWidget);
-    multiPageLayout->setAlignment(Qt::AlignTop);
-    multiPageWidget->setLayout(multiPageLayout);
-
-    scrollArea->takeWidget();
-    scrollArea->setWidget(multiPageWidget);
-    scrollArea->setWidgetResizable(true);
-
-    QSize areaSize = scrollArea->viewport()->size();
-    int targetWidth = areaSize.width() - 20;
-
-    QProgressDialog progress("Rendering all pages...", "Cancel", 0, pageCount, this);
-    progress.setWindowModality(Qt::ApplicationModal);
-    progress.setMinimumDuration(200);
-
-    for (int i = 0; i < pageCount; ++i) {
-        progress.setValue(i);
-        QApplication::processEvents();
-
-        if (progress.wasCanceled())
-            break;
-
-        QImage image;
-
-        if (!isPdf) {
-            ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, i);
-            while (!ddjvu_page_decoding_done(page))
-                ddjvu_message_wait(ctx);
-
-            int origWidth = ddjvu_page_get_width(page);
-            double scale = static_cast<double>(targetWidth) / origWidth;
-
-            image = renderPage(page, scale);
-            ddjvu_page_release(page);
-        } else {
-            auto page = pdfDoc->page(i);
-            if (!page)
-                continue;
-
-            image = page->renderToImage(150, 150); // 150 DPI
-            if (image.isNull())
-                continue;
-
-            image = image.scaledToWidth(targetWidth, Qt::SmoothTransformation);
-        }
-
-        if (nightMode && !image.isNull())
-            image = applyNightMode(image);
-
-        QLabel *pageLabel = new QLabel;
-        pageLabel->setPixmap(QPixmap::fromImage(image));
-        pageLabel->setAlignment(Qt::AlignCenter);
-        pageLabel->setStyleSheet("margin-bottom: 10px;");
-        pageLabel->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Minimum);
-
-        multiPageLayout->addWidget(pageLabel);
-    }
-
-    multiPageLayout->addStretch();
-
-    progress.setValue(pageCount);
+    // Pages are laid out at their final size right away; the page view
+    // requests the ones that scroll into view and fills them in as the render
+    // service delivers previews and then full-quality renders.
+    int page = currentPage;
+    pageView->showContinuous(pageCount, continuousRenderParams());
+    pageView->scrollToPage(page);
 }
 
 
@@ -941,6 +1188,11 @@ void MainWindow::exportToPdf() {
         return;
     }
 
+    if (pdfExporter) {
+        QMessageBox::information(this, "Export to PDF", "An export is already running.");
+        return;
+    }
+
     QString suggestedName = QFileInfo(currentFilePath).completeBaseName() + ".pdf";
     QString suggestedPath = QFileInfo(currentFilePath).absolutePath() + "/" + suggestedName;
 
@@ -954,31 +1206,43 @@ void MainWindow::exportToPdf() {
     if (!pdfPath.endsWith(".pdf", Qt::CaseInsensitive))
         pdfPath += ".pdf";
 
-    QPdfWriter pdfWriter(pdfPath);
-    pdfWriter.setPageSize(QPageSize::A4);
-    pdfWriter.setResolution(300);
-
-    QPainter painter(&pdfWriter);
-
-    for (int i = 0; i < pageCount; ++i) {
-        ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, i);
-        while (!ddjvu_page_decoding_done(page))
-            ddjvu_message_wait(ctx);
-
-        QImage image = renderPage(page, 1.0);
-        ddjvu_page_release(page);
-
-        QRect rect = painter.viewport();
-        QSize imgSize = image.size();
-        imgSize.scale(rect.size(), Qt::KeepAspectRatio);
-        painter.drawImage(QRect(QPoint(0, 0), imgSize), image);
-
-        if (i < pageCount - 1)
-            pdfWriter.newPage();
-    }
+    // Reading goes on while the pages are converted in the background.
+    PdfExporter *exporter = new PdfExporter(&djvu, this);
+    pdfExporter = exporter;
+    QProgressDialog *dialog = new QProgressDialog("Exporting " + QFileInfo(pdfPath).fileName() + "...",
+                                                  "Cancel", 0, pageCount, this);
+    dialog->setWindowTitle("Export to PDF");
+    dialog->setWindowModality(Qt::NonModal);
+    dialog->setMinimumDuration(0);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+
+    connect(dialog, &QProgressDialog::canceled, exporter, &PdfExporter::cancel);
+    connect(exporter, &PdfExporter::progress, dialog, [dialog](int written, int total) {
+        dialog->setMaximum(total);
+        dialog->setValue(written);
+        dialog->setLabelText(QString("Exported page %1 of %2").arg(written).arg(total));
+    });
+    // The dialog deletes itself when closed, possibly before the export ends.
+    QPointer<QProgressDialog> progress = dialog;
+    connect(exporter, &PdfExporter::finished, this, [this, exporter, progress](bool completed, const QString &error) {
+        exporter->deleteLater();
+        if (progress)
+            progress->close();
+        if (completed)
+            QMessageBox::information(this, "Export Complete", "Document exported as PDF successfully.");
+        else if (!error.isEmpty())
+            QMessageBox::warning(this, "Export to PDF", "Export failed: " + error);
+    });
+    exporter->start(currentFilePath, pdfPath);
+}
 
-    painter.end();
-    QMessageBox::information(this, "Export Complete", "Document exported as PDF successfully.");
+void MainWindow::relayoutPages() {
+    // Page sizes arrived: lay the pages out again where the reader is,
+    // without jumping back to the top of the current page.
+    if (continuousScrollMode)
+        pageView->showContinuous(pageCount, continuousRenderParams());
+    else
+        scheduleReload();
 }
 
 void MainWindow::enableFacingPages(bool enabled) {
@@ -990,213 +1254,150 @@ void MainWindow::enableFacingPages(bool enabled) {
     }
 
     if (!enabled) {
-        scrollArea->takeWidget();
-        scrollArea->setWidget(imageLabel);
-        scrollArea->setWidgetResizable(true);
         loadPage(currentPage);
         return;
     }
 
     int leftPage = (currentPage % 2 == 0) ? currentPage : currentPage - 1;
-    int rightPage = leftPage + 1;
-
-    QImage leftImg, rightImg;
-
-    if (isPdf) {
-        auto left = pdfDoc->page(leftPage);
-        if (left)
-            leftImg = left->renderToImage(150, 150).convertToFormat(QImage::Format_RGB888);
-
-        if (rightPage < pageCount) {
-            auto right = pdfDoc->page(rightPage);
-            if (right)
-                rightImg = right->renderToImage(150, 150).convertToFormat(QImage::Format_RGB888);
-        }
-    } else {
-        ddjvu_page_t *left = ddjvu_page_create_by_pageno(doc, leftPage);
-        ddjvu_page_t *right = (rightPage < pageCount)
-                                  ? ddjvu_page_create_by_pageno(doc, rightPage)
-                                  : nullptr;
-
-        while (!ddjvu_page_decoding_done(left)) ddjvu_message_wait(ctx);
-        if (right) while (!ddjvu_page_decoding_done(right)) ddjvu_message_wait(ctx);
-
-        leftImg = renderPage(left, -1);
-        if (right)
-            rightImg = renderPage(right, -1);
-
-        ddjvu_page_release(left);
-        if (right) ddjvu_page_release(right);
-    }
-
-    // Ensure we have at least one valid image
-    if (leftImg.isNull()) {
-        QMessageBox::warning(this, "Facing Pages", "Cannot render left page.");
-        return;
-    }
-
-    if (nightMode) leftImg = applyNightMode(leftImg);
-    if (nightMode && !rightImg.isNull()) rightImg = applyNightMode(rightImg);
-
-    int combinedWidth = leftImg.width() + (rightImg.isNull() ? 0 : rightImg.width());
-    int combinedHeight = std::max(leftImg.height(), rightImg.height());
-
-    QImage combined(combinedWidth, combinedHeight, QImage::Format_RGB888);
-    combined.fill(Qt::black);
-
-    QPainter painter(&combined);
-    painter.drawImage(0, 0, leftImg);
-    if (!rightImg.isNull())
-        painter.drawImage(leftImg.width(), 0, rightImg);
-    painter.end();
-
-    QSize targetSize = scrollArea->viewport()->size();
-    QImage scaled = combined.scaled(targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-
-    QLabel *comboLabel = new QLabel;
-    comboLabel->setPixmap(QPixmap::fromImage(scaled));
-    comboLabel->setAlignment(Qt::AlignCenter);
+    QVector<int> spread{leftPage};
+    if (leftPage + 1 < pageCount)
+        spread.append(leftPage + 1);
 
-    scrollArea->takeWidget();
-    scrollArea->setWidget(comboLabel);
-    scrollArea->setWidgetResizable(true);
+    RenderParams params = facingRenderParams();
+    pageView->showSpread(spread, params);
+    renderService->requestPages(spread, params);
 
-    thumbList->blockSignals(true);
-    thumbList->setCurrentRow(currentPage);
-    thumbList->scrollToItem(thumbList->currentItem(), QAbstractItemView::PositionAtCenter);
-    thumbList->blockSignals(false);
+    selectCurrentThumbnail(true);
 }
 
 
 
 void MainWindow::openPdfFile(const QString &filePath) {
+    beginOpen(filePath);
     if (pdfDoc) {
         pdfDoc.reset();
         pdfDoc = nullptr;
     }
 
-    pdfDoc = Poppler::Document::load(filePath);
-    if (!pdfDoc || pdfDoc->isLocked()) {
-        QMessageBox::warning(this, "Error", "Unable to open PDF or it's encrypted.");
-        return;
-    }
-
-    outlineTree->clear();
-    outlineTree->hide();
-
-    pageCount = pdfDoc->numPages();
-    currentPage = 0;
-    zoom = 1.0;
-    fitToWindow = true;
-
-    loadLastReadState(currentFilePath);
-
-    // Update recent files
-    QSettings settings("MyCompany", "BookReader");
-    QStringList list = settings.value("recentFiles").toStringList();
-    list.removeAll(filePath);
-    list.prepend(filePath);
-    while (list.size() > 5)
-        list.removeLast();
-    settings.setValue("recentFiles", list);
-    updateRecentFilesMenu();
-
-    pageInput->setMaximum(pageCount);
-
-    thumbList->blockSignals(true);
-    thumbList->clear();
-    thumbList->blockSignals(false);
-
-    thumbnails.clear();
-    originalThumbnails.clear();
-
-    if (!showThumbnails) {
-        thumbList->hide();
-    } else {
-        ThumbnailWorker *worker = new ThumbnailWorker(pdfDoc.get(), this);
-        connect(worker, &ThumbnailWorker::thumbnailReady, this, [this](int i, QImage image) {
-            if (i >= thumbnails.size()) {
-                thumbnails.resize(i + 1);
-                originalThumbnails.resize(i + 1);
+    // PDFs are always loaded from the file: Poppler reads it lazily, while
+    // loadFromData() would copy the whole mapping into every document.
+    // The header and cross-reference table are parsed off the GUI thread,
+    // and the page sizes read there too, so laying out pages never loads.
+    int serial = openSerial;
+    openPool.start([this, serial, filePath]() {
+        auto loaded = std::make_shared<std::unique_ptr<Poppler::Document>>(Poppler::Document::load(filePath));
+        QVector<QSizeF> sizes;
+        if (*loaded && !(*loaded)->isLocked()) {
+            sizes.resize((*loaded)->numPages());
+            for (int i = 0; i < sizes.size(); ++i) {
+                if (std::unique_ptr<Poppler::Page> page = (*loaded)->page(i))
+                    sizes[i] = page->pageSizeF();
             }
-
-            originalThumbnails[i] = image;
-
-            if (nightMode)
-                image = applyNightMode(image);
-
-            thumbnails[i] = image;
-
-            QListWidgetItem *item = new QListWidgetItem(QIcon(QPixmap::fromImage(image)), "");
-            thumbList->insertItem(i, item);
-        });
-        connect(worker, &QThread::finished, worker, &QObject::deleteLater);
-        connect(this, &QObject::destroyed, worker, &QThread::quit);
-        connect(this, &QObject::destroyed, worker, &QObject::deleteLater);
-        worker->start();
-        thumbList->show();
-    }
-
-    outlineTree->reset();
-
-    if (pdfDoc) {
-        QList<Poppler::OutlineItem> rootItems = pdfDoc->outline();
-        if (!rootItems.isEmpty()) {
-            for (const Poppler::OutlineItem &item : rootItems)
-                addOutlineItemRecursive(item, nullptr);
         }
-    }
-    loadPage(currentPage);
+        QMetaObject::invokeMethod(this, [this, serial, filePath, loaded, sizes]() {
+            if (serial != openSerial)
+                return;
+            pdfDoc = std::move(*loaded);
+            finishPdfOpen(filePath, sizes);
+        }, Qt::QueuedConnection);
+    });
 }
 
-QImage MainWindow::renderPdfPage(int pageNum, double scale) {
-    if (!pdfDoc)
-        return QImage();
-
-    auto page = pdfDoc->page(pageNum);
-    if (!page)
-        return QImage();
-
-    QImage image = page->renderToImage(scale * 150, scale * 150.0);
-    QSize targetSize = scrollArea->viewport()->size()*1.6;
-    image = image.scaled(targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-
-    if (nightMode && !image.isNull()) {
-        image = applyNightMode(image);
+void MainWindow::finishPdfOpen(const QString &filePath, const QVector<QSizeF> &pageSizes) {
+    if (!pdfDoc || pdfDoc->isLocked()) {
+        pdfDoc.reset();
+        pageView->clear("Open a file");
+        QMessageBox::warning(this, "Error", "Unable to open PDF or it's encrypted.");
+        return;
     }
 
-    return image;
+    pageCount = pdfDoc->numPages();
+    logOpen(filePath, openClock.nsecsElapsed(), openResidentBefore);
+    renderService->setPdfDocument(filePath, pageSizes);
+    showOpenedDocument(filePath);
+
+    QString cacheDirectory = thumbnailDiskCache.documentDirectory(filePath);
+    startThumbnailWorker(new ThumbnailWorker(filePath, cacheDirectory, this));
+    textIndexPending = true;
+    textIndex->setPdfDocument(filePath, pageCount,
+                              cacheDirectory.isEmpty() ? QString() : cacheDirectory + "/text.index");
+
+    // Resolving outline destinations can touch much of the file, so it is
+    // done on a document of its own.
+    int serial = openSerial;
+    int pages = pageCount;
+    openPool.start([this, serial, filePath, pages]() {
+        std::unique_ptr<Poppler::Document> outlineDoc = Poppler::Document::load(filePath);
+        QVector<OutlineEntry> outline;
+        if (outlineDoc && !outlineDoc->isLocked())
+            outline = readOutline(outlineDoc->outline(), pages);
+        QMetaObject::invokeMethod(this, [this, serial, outline]() {
+            if (serial != openSerial)
+                return;
+            for (const OutlineEntry &entry : outline)
+                addOutlineEntry(entry, nullptr);
+            logOpenStage("outline");
+        }, Qt::QueuedConnection);
+    });
 }
 
 void MainWindow::searchAllPages(const QString &text) {
-    if (!pdfDoc || text.isEmpty())
+    if ((!doc && !pdfDoc) || text.isEmpty())
         return;
 
     searchResultsList->clear();
-    searchResultsList->show();
+    searchPanel->show();
+
+    searchAllQuery = TextIndex::fold(text);
+    searchAllNextPage = 0;
+    searchAllMatches = 0;
+    searchProgress->setRange(0, pageCount);
+    searchProgress->show();
+    continueSearchAll();
+}
 
-    for (int i = 0; i < pdfDoc->numPages(); ++i) {
-        auto page = pdfDoc->page(i);
-        if (!page) continue;
+void MainWindow::continueSearchAll() {
+    if (searchAllQuery.isEmpty())
+        return;
 
-        QString pageText = page->text(QRectF());
-        if (pageText.contains(text, Qt::CaseInsensitive)) {
-            // Extract short snippet with match
-            int idx = pageText.indexOf(text, 0, Qt::CaseInsensitive);
-            QString snippet = pageText.mid(std::max(0, idx - 20), text.length() + 40).replace('\n', ' ').trimmed();
+    // Results go into the list in page order, as far as the index reaches.
+    while (searchAllNextPage < pageCount && textIndex->hasPage(searchAllNextPage)) {
+        int i = searchAllNextPage++;
+        if (textIndex->contains(i, searchAllQuery)) {
+            QString snippet = textIndex->snippet(i, searchAllQuery);
 
             QListWidgetItem *item = new QListWidgetItem(QString("Page %1: %2").arg(i + 1).arg(snippet));
             item->setData(Qt::UserRole, i); // store page index
             searchResultsList->addItem(item);
+            ++searchAllMatches;
         }
     }
+    searchProgress->setValue(searchAllNextPage);
 
-    if (searchResultsList->count() == 0)
-        searchResultsList->hide();
+    if (searchAllNextPage < pageCount) {
+        searchStatusLabel->setText(QString("Searching... %1 matching pages").arg(searchAllMatches));
+        return;
+    }
+
+    searchAllQuery.clear();
+    searchProgress->hide();
+    searchStatusLabel->setText(searchAllMatches > 0 ? QString("%1 matching pages").arg(searchAllMatches)
+                                                    : QString("No matches"));
+}
+
+void MainWindow::cancelSearchAll() {
+    if (searchAllQuery.isEmpty())
+        return;
+
+    searchAllQuery.clear();
+    searchProgress->hide();
+    searchStatusLabel->setText(QString("Stopped: %1 matching pages in the first %2")
+                                   .arg(searchAllMatches).arg(searchAllNextPage));
 }
 
 void MainWindow::saveLastReadState() {
-    if (currentFilePath.isEmpty()) return;
+    // A document still opening has no state of its own yet.
+    if (currentFilePath.isEmpty() || pageCount <= 0) return;
 
     QSettings settings("MyCompany", "BookReader");
     QString key = "lastState/" + currentFilePath;
@@ -1224,25 +1425,30 @@ void MainWindow::loadLastReadState(const QString &filePath) {
     continuousScrollMode = settings.value(key + "/continuousScrollMode", false).toBool();
 }
 
-void MainWindow::addOutlineItemRecursive(const Poppler::OutlineItem &item, QTreeWidgetItem *parent) {
-    if (!pdfDoc)
-        return;
+QVector<MainWindow::OutlineEntry> MainWindow::readOutline(const QList<Poppler::OutlineItem> &items, int pageCount) {
+    QVector<OutlineEntry> entries;
+    for (const Poppler::OutlineItem &item : items) {
+        // Resolve the page number
+        int pageNumber = -1;
 
-    // Resolve the page number
-    int pageNumber = -1;
+        if (!item.destination().isNull()) {
+            pageNumber = item.destination()->pageNumber();
+        }
 
-    if (!item.destination().isNull()) {
-        pageNumber = item.destination()->pageNumber();
-    }
+        // Skip if page number is invalid
+        if (pageNumber < 0 || pageNumber >= pageCount)
+            continue;
 
-    // Skip if page number is invalid
-    if (pageNumber < 0 || pageNumber >= pageCount)
-        return;
+        entries.append({item.name(), pageNumber, readOutline(item.children(), pageCount)});
+    }
+    return entries;
+}
 
+void MainWindow::addOutlineEntry(const OutlineEntry &entry, QTreeWidgetItem *parent) {
     // Create the tree widget item
     QTreeWidgetItem *treeItem = new QTreeWidgetItem();
-    treeItem->setText(0, item.name());
-    treeItem->setData(0, Qt::UserRole, pageNumber);
+    treeItem->setText(0, entry.title);
+    treeItem->setData(0, Qt::UserRole, entry.page);
 
     if (parent)
         parent->addChild(treeItem);
@@ -1250,26 +1456,30 @@ void MainWindow::addOutlineItemRecursive(const Poppler::OutlineItem &item, QTree
         outlineTree->addTopLevelItem(treeItem);
 
     // Recursively add children
-    for (const Poppler::OutlineItem &child : item.children()) {
-        addOutlineItemRecursive(child, treeItem);
+    for (const OutlineEntry &child : entry.children) {
+        addOutlineEntry(child, treeItem);
     }
 }
 
 void MainWindow::searchNext(const QString &text)
 {
-    if (text.isEmpty() || !pdfDoc) return;
+    if (text.isEmpty() || (!doc && !pdfDoc)) return;
 
     if (text != lastSearchText) {
         lastSearchText = text;
         lastSearchPage = currentPage - 1; // start after current
     }
 
-    for (int i = lastSearchPage + 1; i < pdfDoc->numPages(); ++i) {
-        auto page = pdfDoc->page(i);
-        if (!page) continue;
-
-        QString pageText = page->text(QRectF());
-        if (pageText.contains(text, Qt::CaseInsensitive)) {
+    // Stops at a page that isn't indexed yet and carries on once it is.
+    searchWaitPage = -1;
+    QString query = TextIndex::fold(text);
+    for (int i = lastSearchPage + 1; i < pageCount; ++i) {
+        if (!textIndex->hasPage(i)) {
+            lastSearchPage = i - 1;
+            waitForSearchPage(i, true);
+            return;
+        }
+        if (textIndex->contains(i, query)) {
             lastSearchPage = i;
             loadPage(i);
             return;
@@ -1281,19 +1491,22 @@ void MainWindow::searchNext(const QString &text)
 
 void MainWindow::searchPrevious(const QString &text)
 {
-    if (text.isEmpty() || !pdfDoc) return;
+    if (text.isEmpty() || (!doc && !pdfDoc)) return;
 
     if (text != lastSearchText) {
         lastSearchText = text;
         lastSearchPage = currentPage + 1; // start before current
     }
 
-    for (int i = lastSearchPage - 1; i >= 0; --i) {
-        auto page = pdfDoc->page(i);
-        if (!page) continue;
-
-        QString pageText = page->text(QRectF());
-        if (pageText.contains(text, Qt::CaseInsensitive)) {
+    searchWaitPage = -1;
+    QString query = TextIndex::fold(text);
+    for (int i = std::min(lastSearchPage, pageCount) - 1; i >= 0; --i) {
+        if (!textIndex->hasPage(i)) {
+            lastSearchPage = i + 1;
+            waitForSearchPage(i, false);
+            return;
+        }
+        if (textIndex->contains(i, query)) {
             lastSearchPage = i;
             loadPage(i);
             return;
@@ -1303,6 +1516,14 @@ void MainWindow::searchPrevious(const QString &text)
     QMessageBox::information(this, "Search", "No previous results.");
 }
 
+void MainWindow::waitForSearchPage(int pageNum, bool forward)
+{
+    searchWaitPage = pageNum;
+    searchWaitForward = forward;
+    textIndex->prioritize(pageNum);
+    statusBar()->showMessage(QString("Searching page %1...").arg(pageNum + 1));
+}
+
 void MainWindow::dragEnterEvent(QDragEnterEvent *event) {
     if (event->mimeData()->hasUrls()) {
         const auto urls = event->mimeData()->urls();
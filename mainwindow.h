@@ -7,15 +7,26 @@
 #include <QSpinBox>
 #include <QSlider>
 #include <QListWidget>
+#include <QListView>
 #include <qboxlayout.h>
 #include <QTreeView>
+#include <QTimer>
+#include <QProgressBar>
 
-#include "imagelabel.h"
 #include "searchdialog.h"
+#include "renderservice.h"
+#include "pageview.h"
+#include "thumbnailmodel.h"
+#include "thumbnaildiskcache.h"
+#include "thumbnailworker.h"
+#include "textindex.h"
+#include "djvubackend.h"
+#include "pdfexporter.h"
 
 #include <QThread>
-#include <QMutex>
-#include <QWaitCondition>
+#include <QThreadPool>
+#include <QPointer>
+#include <QElapsedTimer>
 #include <qtreewidget.h>
 
 
@@ -25,34 +36,6 @@ extern "C" {
 
 #include <poppler-qt6.h>
 
-class ThumbnailWorker : public QThread {
-    Q_OBJECT
-public:
-    ThumbnailWorker(Poppler::Document *doc, QObject *parent = nullptr)
-        : QThread(parent), doc(doc) {}
-
-    void run() override {
-        if (!doc) return;
-
-        for (int i = 0; i < doc->numPages(); ++i) {
-            auto page = doc->page(i);
-            if (!page) continue;
-
-            QImage image = page->renderToImage(36, 36); // Low DPI thumbnail
-
-            if (!image.isNull()) {
-                emit thumbnailReady(i, image);
-            }
-        }
-    }
-
-signals:
-    void thumbnailReady(int index, QImage image);
-
-private:
-    Poppler::Document *doc;
-};
-
 class MainWindow : public QMainWindow {
     Q_OBJECT
 
@@ -82,10 +65,27 @@ private slots:
 
 private:
     void loadPage(int pageNum);
-    QImage renderPage(ddjvu_page_t *page, double customScale);
+    void updatePageIndicators();
+    void reloadView();
+    QVector<QRectF> searchHighlights(int pageNum);
+    RenderParams currentRenderParams() const;
+    RenderParams facingRenderParams() const;
+    RenderParams continuousRenderParams() const;
     void openDjvuFile(const QString &filePath);
     void openPdfFile(const QString &filePath);
 
+    // Opening is staged: the header is parsed without blocking the event
+    // loop, then the restored page is shown, then the outline, thumbnails
+    // and text index follow in the background. Each stage is timed from
+    // beginOpen() and logged.
+    void beginOpen(const QString &filePath);
+    void finishDjvuOpen(const QString &filePath);
+    void finishPdfOpen(const QString &filePath, const QVector<QSizeF> &pageSizes);
+    void showOpenedDocument(const QString &filePath);
+    void logOpenStage(const QString &stage);
+
+    // Declared first: everything DjVu below is created on its context.
+    DjvuBackend djvu{"djvu_reader"};
     ddjvu_context_t *ctx = nullptr;
     ddjvu_document_t *doc = nullptr;
     int pageCount = 0;
@@ -94,8 +94,14 @@ private:
 
     bool fitToWindow = true;
 
-    QScrollArea *scrollArea;
-    ImageLabel *imageLabel;
+    RenderService *renderService = nullptr;
+
+    // Coalesces bursts of reloads (window resizes, warmth slider drags) into one render.
+    QTimer *reloadTimer = nullptr;
+    void scheduleReload();
+    void relayoutPages();
+
+    PageView *pageView;
     QPushButton *nextBtn;
     QPushButton *prevBtn;
 
@@ -104,26 +110,37 @@ private:
     QLabel *pageLabel;
     QSpinBox *pageInput;
 
-    QListWidget *thumbList;
-    QVector<QImage> thumbnails;
-    QVector<QImage> originalThumbnails;
+    QListView *thumbList;
+    ThumbnailModel *thumbnailModel;
+
+    // Thumbnails are produced by a worker thread per document. The serial
+    // drops results from a worker that belongs to a previously opened file.
+    QPointer<ThumbnailThread> thumbnailWorker;
+    ThumbnailDiskCache thumbnailDiskCache;
+    int thumbnailSerial = 0;
+    void startThumbnailWorker(ThumbnailThread *worker);
+
+    void stopThumbnailWorker();
+
+    // Asks the worker for the rows in view, then a screenful either side.
+    QTimer *thumbnailTimer = nullptr;
+    void requestVisibleThumbnails();
+    void selectCurrentThumbnail(bool center);
 
     QStringList recentFiles;
     QMenu *recentFilesMenu = nullptr;
     void updateRecentFilesMenu();
 
+    // Runs on threads of its own; deleted once the export has finished.
+    QPointer<PdfExporter> pdfExporter;
+
     bool nightMode = false;
-    bool isDarkMode = true;
     bool isFullScreen = false;
     QString currentFilePath;
 
     bool continuousScrollMode = false;
-    QWidget *multiPageWidget = nullptr;
-    QVBoxLayout *multiPageLayout = nullptr;
 
     bool facingPagesMode = false;
-    QWidget *dualPageWidget = nullptr;
-    QHBoxLayout *dualPageLayout = nullptr;
 
     QAction *fitToWindowAction = nullptr;
 
@@ -137,24 +154,55 @@ private:
     void applyTheme(Theme theme);
     void enableContinuousScroll(bool enabled);
     void enableFacingPages(bool enabled);
-    void loadSinglePage();
     void refreshThumbnails();
     void saveLastReadState();
     void loadLastReadState(const QString &filePath);
-    void addOutlineItemRecursive(const Poppler::OutlineItem &item, QTreeWidgetItem *parent);
+
+    // Outline entries with their destinations resolved, so the tree can be
+    // filled on the GUI thread without touching the document.
+    struct OutlineEntry {
+        QString title;
+        int page = -1;
+        QVector<OutlineEntry> children;
+    };
+    static QVector<OutlineEntry> readOutline(const QList<Poppler::OutlineItem> &items, int pageCount);
+    void addOutlineEntry(const OutlineEntry &entry, QTreeWidgetItem *parent);
 
     void searchNext(const QString& text);
     void searchPrevious(const QString& text);
 
     bool autoNightMode = true;
     int warmthLevel = 20; // 0–100, default warm
-    QImage applyNightMode(const QImage &input);
-
-    QImage renderPdfPage(int pageNum, double scale);
 
     int lastSearchPage = -1;
     QString lastSearchText;
 
+    QThreadPool openPool;
+    int openSerial = 0; // results of an open that was superseded are dropped
+    QElapsedTimer openClock;
+    qint64 openResidentBefore = -1;
+    bool firstPixelPending = false;
+    bool textIndexPending = false;
+    QStringList openLog;
+    void logOpen(const QString &filePath, qint64 elapsedNanoseconds, qint64 residentBefore);
+
+    TextIndex *textIndex = nullptr;
+
+    // Highlights, selections and searches that need a page the text index
+    // hasn't reached yet have it prioritized and finish once it arrives.
+    void onPageIndexed(int pageNum);
+    int highlightWaitPage = -1;
+    int searchWaitPage = -1;
+    bool searchWaitForward = true;
+    void waitForSearchPage(int pageNum, bool forward);
+
+    // Words selected in the page view, in text order.
+    int selectionPage = -1;
+    QRectF selectionRect;
+    QVector<int> selectedWords;
+    void updateSelection();
+    void copySelection();
+
     // QWidget *searchBar = nullptr;
     // QLineEdit *searchEdit = nullptr;
     // QPushButton *searchNextBtn = nullptr;
@@ -163,6 +211,18 @@ private:
     QTreeWidget *outlineTree = nullptr;
 
     QListWidget *searchResultsList = nullptr;
+    QWidget *searchPanel = nullptr;
+    QLabel *searchStatusLabel = nullptr;
+    QProgressBar *searchProgress = nullptr;
+
+    // Search all pages walks the pages in order as the text index fills them
+    // in, so results appear while extraction is still running. The query is
+    // empty when no search is running.
+    QString searchAllQuery;
+    int searchAllNextPage = 0;
+    int searchAllMatches = 0;
+    void continueSearchAll();
+    void cancelSearchAll();
 
     void searchAllPages(const QString &text);
 
@@ -0,0 +1,108 @@
+// Times PageRenderer::applyNightMode() against the per-pixel QColor round
+// trip it replaced, on a gray and a colour version of the same page, and
+// counts the pixels where the two disagree.
+//
+// Usage: nightmodebenchmark [page image] [warmth level]
+
+#include "pagerenderer.h"
+
+#include <QColor>
+#include <QElapsedTimer>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+QImage applyNightModeReference(const QImage &input, int warmthLevel) {
+    QImage img = input.convertToFormat(QImage::Format_ARGB32);
+    for (int y = 0; y < img.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < img.width(); ++x) {
+            QColor color = QColor::fromRgb(line[x]);
+
+            int h, s, v;
+            color.getHsv(&h, &s, &v);
+
+            // Invert brightness
+            v = 255 - v;
+
+            // Add warmth by shifting hue slightly toward red/yellow
+            h = (h + warmthLevel) % 360;
+
+            QColor newColor;
+            newColor.setHsv(h, s, v);
+            line[x] = newColor.rgba();
+        }
+    }
+    return img;
+}
+
+// A letter page at 300 dpi: paper with lines of dark text.
+QImage syntheticPage() {
+    QImage page(2550, 3300, QImage::Format_RGB32);
+    for (int y = 0; y < page.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(page.scanLine(y));
+        bool textRow = y % 60 < 30;
+        for (int x = 0; x < page.width(); ++x) {
+            int ink = textRow && (x * 7 + y * 3) % 23 < 9 ? 20 + (x + y) % 40 : 235 + (x ^ y) % 20;
+            line[x] = qRgb(ink, ink, ink);
+        }
+    }
+    return page;
+}
+
+void measure(const char *label, const QImage &image, int warmthLevel) {
+    QElapsedTimer timer;
+    timer.start();
+    QImage reference = applyNightModeReference(image, warmthLevel);
+    qint64 referenceNs = timer.nsecsElapsed();
+
+    timer.restart();
+    QImage fast = PageRenderer::applyNightMode(image, warmthLevel);
+    qint64 fastNs = timer.nsecsElapsed();
+
+    qint64 mismatches = 0;
+    for (int y = 0; y < image.height(); ++y) {
+        const QRgb *a = reinterpret_cast<const QRgb *>(reference.constScanLine(y));
+        const QRgb *b = reinterpret_cast<const QRgb *>(fast.constScanLine(y));
+        for (int x = 0; x < image.width(); ++x)
+            mismatches += a[x] != b[x];
+    }
+
+    std::printf("%s:\n", label);
+    std::printf("  QColor round trip: %.2f ms\n", referenceNs / 1e6);
+    std::printf("  Night mode kernel: %.2f ms\n", fastNs / 1e6);
+    std::printf("  Speedup: %.1fx\n", fastNs > 0 ? double(referenceNs) / fastNs : 0.0);
+    std::printf("  Differing pixels: %lld\n", static_cast<long long>(mismatches));
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QImage sample = argc > 1 ? QImage(QString::fromLocal8Bit(argv[1])) : syntheticPage();
+    int warmthLevel = argc > 2 ? std::atoi(argv[2]) : 20;
+    if (sample.isNull()) {
+        std::fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 1;
+    }
+    sample = sample.convertToFormat(QImage::Format_RGB32);
+
+    // Gray and chromatic pixels take different paths, so each is timed on
+    // a sample made only of that kind: the page in grayscale, and the page
+    // tinted by a hue sweep across its width.
+    QImage gray = sample.convertToFormat(QImage::Format_Grayscale8).convertToFormat(QImage::Format_RGB32);
+    QImage colour(sample.size(), QImage::Format_RGB32);
+    for (int y = 0; y < sample.height(); ++y) {
+        const QRgb *in = reinterpret_cast<const QRgb *>(sample.constScanLine(y));
+        QRgb *out = reinterpret_cast<QRgb *>(colour.scanLine(y));
+        for (int x = 0; x < sample.width(); ++x)
+            out[x] = QColor::fromHsv(x * 360 / sample.width() % 360, 160, 64 + qGray(in[x]) * 191 / 255).rgb();
+    }
+
+    std::printf("Page: %d x %d px, warmth %d\n\n", sample.width(), sample.height(), warmthLevel);
+    measure("Gray page", gray, warmthLevel);
+    std::printf("\n");
+    measure("Colour page", colour, warmthLevel);
+    return 0;
+}
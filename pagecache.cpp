@@ -0,0 +1,94 @@
+#include "pagecache.h"
+
+#include <QHashFunctions>
+
+#include <algorithm>
+
+size_t qHash(const PageKey &key, size_t seed) {
+    return qHashMulti(seed, key.document, key.page, key.scale, key.size.width(), key.size.height(),
+                      key.tile.x(), key.tile.y(), key.tile.width(), key.tile.height(),
+                      key.preview, key.nightMode, key.warmthLevel, static_cast<int>(key.backend));
+}
+
+PageCache::PageCache(qint64 budgetBytes)
+    : maxBytes(budgetBytes)
+{
+}
+
+void PageCache::setBudget(qint64 bytes) {
+    maxBytes = std::max<qint64>(0, bytes);
+    evictToBudget();
+}
+
+QImage PageCache::find(const PageKey &key) {
+    auto it = index.constFind(key);
+    if (it == index.constEnd()) {
+        ++misses;
+        return QImage();
+    }
+
+    ++hits;
+    lru.splice(lru.begin(), lru, *it);
+    return lru.front().image;
+}
+
+QImage PageCache::peek(const PageKey &key) const {
+    auto it = index.constFind(key);
+    return it == index.constEnd() ? QImage() : (*it)->image;
+}
+
+bool PageCache::touch(const PageKey &key) {
+    auto it = index.constFind(key);
+    if (it == index.constEnd())
+        return false;
+    lru.splice(lru.begin(), lru, *it);
+    return true;
+}
+
+void PageCache::insert(const PageKey &key, const QImage &image) {
+    if (image.isNull())
+        return;
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        usedBytes -= (*it)->bytes;
+        lru.erase(*it);
+        index.erase(it);
+    }
+
+    qint64 bytes = image.sizeInBytes();
+    if (bytes > maxBytes)
+        return;
+
+    lru.push_front({key, image, bytes});
+    index.insert(key, lru.begin());
+    usedBytes += bytes;
+    evictToBudget();
+}
+
+void PageCache::clear() {
+    lru.clear();
+    index.clear();
+    usedBytes = 0;
+}
+
+PageCache::Stats PageCache::stats() const {
+    Stats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.bytes = usedBytes;
+    stats.budget = maxBytes;
+    stats.entries = static_cast<int>(index.size());
+    return stats;
+}
+
+void PageCache::evictToBudget() {
+    while (usedBytes > maxBytes && !lru.empty()) {
+        const Entry &oldest = lru.back();
+        usedBytes -= oldest.bytes;
+        index.remove(oldest.key);
+        lru.pop_back();
+        ++evictions;
+    }
+}
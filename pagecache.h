@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QRect>
+#include <QString>
+
+#include <list>
+
+// Identifies one rendered page image or tile. Two requests with equal keys produce
+// identical pixels, so a cached image can stand in for a render.
+struct PageKey {
+    enum Backend { Djvu, Pdf };
+
+    QString document;
+    int page = -1;
+    double scale = 0.0;
+    QSize size;
+    QRect tile; // null for the whole page
+    bool preview = false;
+    bool nightMode = false;
+    int warmthLevel = 0;
+    Backend backend = Djvu;
+
+    bool operator==(const PageKey &other) const {
+        return page == other.page
+               && scale == other.scale
+               && size == other.size
+               && tile == other.tile
+               && preview == other.preview
+               && nightMode == other.nightMode
+               && warmthLevel == other.warmthLevel
+               && backend == other.backend
+               && document == other.document;
+    }
+};
+
+size_t qHash(const PageKey &key, size_t seed = 0);
+
+// LRU cache of rendered page images bounded by their total size in bytes.
+class PageCache {
+public:
+    struct Stats {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        qint64 evictions = 0;
+        qint64 bytes = 0;
+        qint64 budget = 0;
+        int entries = 0;
+    };
+
+    explicit PageCache(qint64 budgetBytes = 256ll * 1024 * 1024);
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return maxBytes; }
+
+    // Looks up an image, counting a hit or a miss and refreshing its recency.
+    QImage find(const PageKey &key);
+    bool contains(const PageKey &key) const { return index.contains(key); }
+
+    // Looks up an image without touching recency or the counters.
+    QImage peek(const PageKey &key) const;
+
+    // Marks an image as recently used without counting a lookup; false if
+    // it isn't cached.
+    bool touch(const PageKey &key);
+
+    void insert(const PageKey &key, const QImage &image);
+    void clear();
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        PageKey key;
+        QImage image;
+        qint64 bytes;
+    };
+
+    void evictToBudget();
+
+    // Most recently used entries are at the front.
+    std::list<Entry> lru;
+    QHash<PageKey, std::list<Entry>::iterator> index;
+
+    qint64 maxBytes;
+    qint64 usedBytes = 0;
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 evictions = 0;
+};
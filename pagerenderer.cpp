@@ -0,0 +1,378 @@
+#include "pagerenderer.h"
+
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QVariant>
+
+#include <algorithm>
+#include <climits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace PageRenderer {
+
+namespace {
+
+// Rows rendered per ddjvu_page_render call, i.e. how often cancellation is checked.
+constexpr int BandHeight = 256;
+
+// Smallest band of rows worth handing to another thread for night mode.
+constexpr int NightModeBandRows = 64;
+
+bool isCancelled(const CancelFlag *cancelled) {
+    return cancelled && cancelled->load(std::memory_order_relaxed);
+}
+
+bool shouldAbortRender(const QVariant &payload) {
+    return isCancelled(reinterpret_cast<const CancelFlag *>(payload.value<quintptr>()));
+}
+
+// DjVuLibre writes 0xffRRGGBB words, i.e. QImage::Format_RGB32, straight
+// into the image's own buffer: no staging copy and no format conversion.
+ddjvu_format_t *createRgb32Format() {
+    static unsigned int masks[4] = {0xff0000, 0xff00, 0xff, 0xff000000};
+    ddjvu_format_t *fmt = ddjvu_format_create(DDJVU_FORMAT_RGBMASK32, 4, masks);
+    ddjvu_format_set_row_order(fmt, 1);
+    ddjvu_format_set_y_direction(fmt, 1);
+    return fmt;
+}
+
+QImage renderPdfRegion(Poppler::Page *page, double dpi, const QRect &region, const CancelFlag *cancelled) {
+    QImage image = page->renderToImage(dpi, dpi, region.x(), region.y(), region.width(), region.height(),
+                                       Poppler::Page::Rotate0, nullptr, nullptr, shouldAbortRender,
+                                       QVariant::fromValue(reinterpret_cast<quintptr>(cancelled)));
+    return isCancelled(cancelled) ? QImage() : image;
+}
+
+// 16-bit colour component to 8 bits, rounding the way QColor does.
+inline int div257(int x) {
+    return (x - (x >> 8) + 0x80) >> 8;
+}
+
+// Night mode inverts HSV value and rotates hue by the warmth level. This is
+// QColor's fromRgb/getHsv/setHsv/rgba round trip spelled out on the same
+// 16-bit components and float math, so results match the QColor round trip
+// (nightmodebenchmark checks this) without constructing a QColor per pixel.
+QRgb nightModePixel(QRgb pixel, int warmthLevel) {
+    const float r = qRed(pixel) * 0x101 / float(USHRT_MAX);
+    const float g = qGreen(pixel) * 0x101 / float(USHRT_MAX);
+    const float b = qBlue(pixel) * 0x101 / float(USHRT_MAX);
+    const float max = std::max({r, g, b});
+    const float min = std::min({r, g, b});
+    const float delta = max - min;
+
+    int v = 255 - div257(qRound(max * USHRT_MAX));
+    if (delta == 0.0f)
+        return qRgb(v, v, v);
+
+    int s = div257(qRound((delta / max) * USHRT_MAX));
+    float hue;
+    if (r == max)
+        hue = (g - b) / delta;
+    else if (g == max)
+        hue = 2.0f + (b - r) / delta;
+    else
+        hue = 4.0f + (r - g) / delta;
+    hue *= 60.0f;
+    if (hue < 0.0f)
+        hue += 360.0f;
+    int h = (qRound(hue * 100.0f) / 100 + warmthLevel) % 360;
+    if (s == 0)
+        return qRgb(v, v, v);
+
+    const float hf = h * 100 / 6000.0f;
+    const float sf = s * 0x101 / float(USHRT_MAX);
+    const float vf = v * 0x101 / float(USHRT_MAX);
+    const int i = int(hf);
+    const float f = hf - i;
+    const float p = vf * (1.0f - sf);
+    float red, green, blue;
+    if (i & 1) {
+        const float q = vf * (1.0f - (sf * f));
+        switch (i) {
+        case 1: red = q; green = vf; blue = p; break;
+        case 3: red = p; green = q; blue = vf; break;
+        default: red = vf; green = p; blue = q; break;
+        }
+    } else {
+        const float t = vf * (1.0f - (sf * (1.0f - f)));
+        switch (i) {
+        case 0: red = vf; green = t; blue = p; break;
+        case 2: red = p; green = vf; blue = t; break;
+        default: red = t; green = p; blue = vf; break;
+        }
+    }
+    return qRgb(div257(qRound(red * USHRT_MAX)), div257(qRound(green * USHRT_MAX)),
+                div257(qRound(blue * USHRT_MAX)));
+}
+
+#ifdef __SSE2__
+// Four pixels through nightModePixel() at once: the same float operations in
+// the same order, so every lane rounds exactly as the scalar code does.
+inline __m128i nightModePixels(__m128i px, __m128i warmth) {
+    const __m128i lowByte = _mm_set1_epi32(0xff);
+    const __m128 scale = _mm_set1_ps(float(USHRT_MAX));
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    auto toFloat = [&](__m128i component) { // x * 0x101 / float(USHRT_MAX)
+        return _mm_div_ps(_mm_cvtepi32_ps(_mm_or_si128(component, _mm_slli_epi32(component, 8))), scale);
+    };
+    auto toByte = [&](__m128 c) { // div257(qRound(c * USHRT_MAX)), c >= 0
+        __m128i x = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+        return _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(x, _mm_srli_epi32(x, 8)), _mm_set1_epi32(0x80)), 8);
+    };
+    auto select = [](__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    };
+
+    const __m128 r = toFloat(_mm_and_si128(_mm_srli_epi32(px, 16), lowByte));
+    const __m128 g = toFloat(_mm_and_si128(_mm_srli_epi32(px, 8), lowByte));
+    const __m128 b = toFloat(_mm_and_si128(px, lowByte));
+    const __m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+    const __m128 min = _mm_min_ps(_mm_min_ps(r, g), b);
+    const __m128 delta = _mm_sub_ps(max, min);
+
+    const __m128i v = _mm_sub_epi32(lowByte, toByte(max));
+    const __m128i s = toByte(_mm_div_ps(delta, max));
+
+    const __m128 redMax = _mm_cmpeq_ps(r, max);
+    const __m128 greenMax = _mm_andnot_ps(redMax, _mm_cmpeq_ps(g, max));
+    const __m128 blueMax = _mm_andnot_ps(_mm_or_ps(redMax, greenMax), _mm_cmpeq_ps(max, max));
+    __m128 hue = _mm_div_ps(select(redMax, _mm_sub_ps(g, b), select(greenMax, _mm_sub_ps(b, r), _mm_sub_ps(r, g))), delta);
+    hue = _mm_add_ps(hue, _mm_or_ps(_mm_and_ps(greenMax, _mm_set1_ps(2.0f)), _mm_and_ps(blueMax, _mm_set1_ps(4.0f))));
+    hue = _mm_mul_ps(hue, _mm_set1_ps(60.0f));
+    hue = _mm_add_ps(hue, _mm_and_ps(_mm_cmplt_ps(hue, _mm_setzero_ps()), _mm_set1_ps(360.0f)));
+    // qRound(hue * 100) / 100 + warmth, modulo 360; x / 100 is (x * 5243) >> 19 below 43699.
+    __m128i h = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(hue, _mm_set1_ps(100.0f)), half));
+    h = _mm_add_epi32(_mm_srli_epi32(_mm_mulhi_epu16(h, _mm_set1_epi32(5243)), 3), warmth);
+    h = _mm_sub_epi32(h, _mm_and_si128(_mm_cmpgt_epi32(h, _mm_set1_epi32(359)), _mm_set1_epi32(360)));
+
+    // Back to RGB by sextant.
+    const __m128 hf = _mm_div_ps(_mm_cvtepi32_ps(_mm_mullo_epi16(h, _mm_set1_epi32(100))), _mm_set1_ps(6000.0f));
+    const __m128i sextant = _mm_cvttps_epi32(hf);
+    const __m128 f = _mm_sub_ps(hf, _mm_cvtepi32_ps(sextant));
+    const __m128 sf = toFloat(s);
+    const __m128 vf = toFloat(v);
+    const __m128 p = _mm_mul_ps(vf, _mm_sub_ps(one, sf));
+    const __m128 odd = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(sextant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    const __m128 x = _mm_mul_ps(vf, _mm_sub_ps(one, _mm_mul_ps(sf, select(odd, f, _mm_sub_ps(one, f)))));
+    auto in = [&](int a, int b) {
+        return _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(sextant, _mm_set1_epi32(a)), _mm_cmpeq_epi32(sextant, _mm_set1_epi32(b))));
+    };
+    const __m128i red = toByte(select(in(0, 5), vf, select(in(2, 3), p, x)));
+    const __m128i green = toByte(select(in(1, 2), vf, select(in(4, 5), p, x)));
+    const __m128i blue = toByte(select(in(3, 4), vf, select(in(0, 1), p, x)));
+    __m128i out = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(red, 16), _mm_slli_epi32(green, 8)), blue);
+
+    // Gray lanes (and s == 0, which nightModePixel also leaves gray) only flip the value.
+    const __m128i gray = _mm_or_si128(_mm_castps_si128(_mm_cmpeq_ps(delta, _mm_setzero_ps())), _mm_cmpeq_epi32(s, _mm_setzero_si128()));
+    const __m128i vvv = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(v, 16), _mm_slli_epi32(v, 8)), v);
+    out = _mm_or_si128(_mm_and_si128(gray, vvv), _mm_andnot_si128(gray, out));
+    return _mm_or_si128(out, _mm_set1_epi32(static_cast<int>(0xff000000)));
+}
+#endif
+
+void nightModeRows(uchar *bits, qsizetype bytesPerLine, int width, int firstRow, int lastRow, int warmthLevel) {
+    // Text and paper come in long runs of the same colour, so the last
+    // chromatic conversion left to the scalar path is remembered.
+    QRgb lastIn = 0;
+    QRgb lastOut = nightModePixel(lastIn, warmthLevel);
+    auto convert = [&](QRgb pixel) {
+        if (qRed(pixel) == qGreen(pixel) && qGreen(pixel) == qBlue(pixel))
+            return (pixel ^ 0x00ffffff) | 0xff000000; // gray: only the value flips
+        if (pixel != lastIn) {
+            lastIn = pixel;
+            lastOut = nightModePixel(pixel, warmthLevel);
+        }
+        return lastOut;
+    };
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(bits + y * bytesPerLine);
+        int x = 0;
+#ifdef __SSE2__
+        // Scanned pages are mostly gray: four gray pixels at a time are just
+        // inverted. Groups with colour go through the vector conversion.
+        const __m128i lowByte = _mm_set1_epi32(0xff);
+        const __m128i invert = _mm_set1_epi32(0x00ffffff);
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000));
+        // The vector hue rotation wraps once, so it takes warmth in 0..359.
+        const int colourWarmth = warmthLevel >= 0 ? warmthLevel % 360 : -1;
+        for (; x + 4 <= width; x += 4) {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + x));
+            __m128i blue = _mm_and_si128(px, lowByte);
+            __m128i green = _mm_and_si128(_mm_srli_epi32(px, 8), lowByte);
+            __m128i red = _mm_and_si128(_mm_srli_epi32(px, 16), lowByte);
+            __m128i gray = _mm_and_si128(_mm_cmpeq_epi32(red, green), _mm_cmpeq_epi32(green, blue));
+            if (_mm_movemask_epi8(gray) == 0xffff) {
+                px = _mm_or_si128(_mm_xor_si128(px, invert), opaque);
+            } else if (colourWarmth >= 0) {
+                px = nightModePixels(px, _mm_set1_epi32(colourWarmth));
+            } else {
+                for (int i = 0; i < 4; ++i)
+                    line[x + i] = convert(line[x + i]);
+                continue;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), px);
+        }
+#endif
+        for (; x < width; ++x)
+            line[x] = convert(line[x]);
+    }
+}
+
+// Bands of one image are spread over their own pool: applyNightMode() runs on
+// render workers, which must not wait on jobs queued behind other renders.
+QThreadPool &nightModePool() {
+    static QThreadPool pool;
+    return pool;
+}
+
+}
+
+double pageScale(const QSizeF &pageSize, const RenderParams &params) {
+    if (pageSize.width() <= 0 || pageSize.height() <= 0)
+        return 0.0;
+
+    double scaleW = params.viewportSize.width() / pageSize.width();
+    double scale = scaleW;
+    if (!params.fitWidth) {
+        double scaleH = params.viewportSize.height() / pageSize.height();
+        scale = std::min(scaleW, scaleH);
+        if (!params.fitToWindow)
+            scale *= params.zoom;
+    }
+    return scale * params.devicePixelRatio;
+}
+
+double djvuScale(int origWidth, int origHeight, const RenderParams &params) {
+    return pageScale(QSizeF(origWidth, origHeight), params);
+}
+
+double pdfDpi(const QSizeF &pageSize, const RenderParams &params) {
+    return pageScale(pageSize, params) * 72.0;
+}
+
+QSize scaledPageSize(const QSizeF &pageSize, double scale) {
+    return QSize(static_cast<int>(pageSize.width() * scale), static_cast<int>(pageSize.height() * scale));
+}
+
+QImage renderDjvu(ddjvu_page_t *page, double scale, const CancelFlag *cancelled) {
+    QSize size = scaledPageSize(QSizeF(ddjvu_page_get_width(page), ddjvu_page_get_height(page)), scale);
+    return renderDjvuTile(page, scale, QRect(QPoint(0, 0), size), cancelled);
+}
+
+QImage renderPdf(Poppler::Page *page, const RenderParams &params, const CancelFlag *cancelled) {
+    // Rendered once at the final size; Poppler's output needs no resampling.
+    QSizeF pageSize = page->pageSizeF();
+    QSize size = scaledPageSize(pageSize, pageScale(pageSize, params));
+    return renderPdfRegion(page, pdfDpi(pageSize, params), QRect(QPoint(0, 0), size), cancelled);
+}
+
+QImage renderDjvuTile(ddjvu_page_t *page, double scale, const QRect &tile, const CancelFlag *cancelled) {
+    QSize size = scaledPageSize(QSizeF(ddjvu_page_get_width(page), ddjvu_page_get_height(page)), scale);
+    int width = size.width();
+    int height = size.height();
+    QRect area = tile & QRect(0, 0, width, height);
+    if (area.isEmpty())
+        return QImage();
+
+    ddjvu_rect_t prect = {0, 0, static_cast<unsigned int>(width), static_cast<unsigned int>(height)};
+    ddjvu_format_t *fmt = createRgb32Format();
+
+    QImage image(area.size(), QImage::Format_RGB32);
+    if (image.isNull()) {
+        ddjvu_format_release(fmt);
+        return image;
+    }
+
+    for (int y = area.top(); y <= area.bottom(); y += BandHeight) {
+        if (isCancelled(cancelled)) {
+            ddjvu_format_release(fmt);
+            return QImage();
+        }
+
+        int bandHeight = std::min(BandHeight, area.bottom() + 1 - y);
+        ddjvu_rect_t band = {area.x(), y, static_cast<unsigned int>(area.width()), static_cast<unsigned int>(bandHeight)};
+        ddjvu_page_render(page, DDJVU_RENDER_COLOR, &prect, &band, fmt, image.bytesPerLine(),
+                          reinterpret_cast<char *>(image.scanLine(y - area.top())));
+    }
+    ddjvu_format_release(fmt);
+
+    return image;
+}
+
+QImage renderPdfTile(Poppler::Page *page, double dpi, const QRect &tile, const CancelFlag *cancelled) {
+    return renderPdfRegion(page, dpi, tile, cancelled);
+}
+
+bool djvuHasThumbnails(ddjvu_document_t *document) {
+    int files = ddjvu_document_get_filenum(document);
+    for (int i = 0; i < files; ++i) {
+        ddjvu_fileinfo_t info;
+        if (ddjvu_document_get_fileinfo(document, i, &info) == DDJVU_JOB_OK && info.type == 'T')
+            return true;
+    }
+    return false;
+}
+
+QImage renderDjvuThumbnail(ddjvu_document_t *document, int pageNum, const QSize &box) {
+    QImage image(box, QImage::Format_RGB32);
+    if (image.isNull())
+        return image;
+
+    // libdjvu shrinks the requested size to keep the thumbnail's aspect ratio.
+    int width = box.width();
+    int height = box.height();
+    ddjvu_format_t *fmt = createRgb32Format();
+    bool ok = ddjvu_thumbnail_render(document, pageNum, &width, &height, fmt, image.bytesPerLine(),
+                                     reinterpret_cast<char *>(image.bits()));
+    ddjvu_format_release(fmt);
+
+    if (!ok || width <= 0 || height <= 0)
+        return QImage();
+    return width == box.width() && height == box.height() ? image : image.copy(0, 0, width, height);
+}
+
+QImage applyNightMode(QImage image, int warmthLevel) {
+    // Pages arrive as opaque 32-bit images and are modified in place; anything
+    // else is converted once.
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32
+        && image.format() != QImage::Format_ARGB32_Premultiplied)
+        image = image.convertToFormat(QImage::Format_RGB32);
+    if (image.isNull())
+        return image;
+
+    // Detach once here; the bands only touch raw scanline memory.
+    uchar *bits = image.bits();
+    qsizetype bytesPerLine = image.bytesPerLine();
+    int width = image.width();
+    int height = image.height();
+
+    QThreadPool &pool = nightModePool();
+    int bands = std::min(pool.maxThreadCount() + 1, (height + NightModeBandRows - 1) / NightModeBandRows);
+    if (bands <= 1) {
+        nightModeRows(bits, bytesPerLine, width, 0, height, warmthLevel);
+        return image;
+    }
+
+    int bandRows = (height + bands - 1) / bands;
+    QSemaphore done;
+    int started = 0;
+    for (int first = bandRows; first < height; first += bandRows) {
+        int last = std::min(height, first + bandRows);
+        pool.start([=, &done]() {
+            nightModeRows(bits, bytesPerLine, width, first, last, warmthLevel);
+            done.release();
+        });
+        ++started;
+    }
+    nightModeRows(bits, bytesPerLine, width, 0, std::min(height, bandRows), warmthLevel);
+    done.acquire(started);
+    return image;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QSizeF>
+
+#include <atomic>
+
+extern "C" {
+#include <libdjvu/ddjvuapi.h>
+}
+
+#include <poppler-qt6.h>
+
+// Everything that determines how a page is rasterized, independent of widgets,
+// so pages can be rendered off the GUI thread.
+struct RenderParams {
+    QSize viewportSize;
+    bool fitToWindow = true;
+    bool fitWidth = false; // continuous scroll: fill the viewport width only
+    double zoom = 1.0;
+    qreal devicePixelRatio = 1.0; // pages are rasterized in device pixels
+    bool nightMode = false;
+    int warmthLevel = 20;
+
+    bool operator==(const RenderParams &other) const {
+        return viewportSize == other.viewportSize
+               && fitToWindow == other.fitToWindow
+               && fitWidth == other.fitWidth
+               && zoom == other.zoom
+               && devicePixelRatio == other.devicePixelRatio
+               && nightMode == other.nightMode
+               && warmthLevel == other.warmthLevel;
+    }
+    bool operator!=(const RenderParams &other) const { return !(*this == other); }
+};
+
+namespace PageRenderer {
+
+// Renders poll this flag between bands and give up (returning a null image)
+// once it is set, so superseded work doesn't hold a worker.
+using CancelFlag = std::atomic<bool>;
+
+// Device pixels per page unit (DjVu pixels, PDF points) for the fit mode and zoom.
+double pageScale(const QSizeF &pageSize, const RenderParams &params);
+double djvuScale(int origWidth, int origHeight, const RenderParams &params);
+
+// Resolution at which a PDF page comes out at exactly its final pixel size.
+double pdfDpi(const QSizeF &pageSize, const RenderParams &params);
+
+QSize scaledPageSize(const QSizeF &pageSize, double scale);
+
+QImage renderDjvu(ddjvu_page_t *page, double scale, const CancelFlag *cancelled = nullptr);
+QImage renderPdf(Poppler::Page *page, const RenderParams &params, const CancelFlag *cancelled = nullptr);
+
+// Render only the given rectangle of the page as it would appear at this scale/DPI.
+QImage renderDjvuTile(ddjvu_page_t *page, double scale, const QRect &tile, const CancelFlag *cancelled = nullptr);
+QImage renderPdfTile(Poppler::Page *page, double dpi, const QRect &tile, const CancelFlag *cancelled = nullptr);
+
+// Thumbnails stored in the document (DjVu TH chunks). ddjvu_thumbnail_status()
+// must have reported DDJVU_JOB_OK for the page before it is rendered.
+bool djvuHasThumbnails(ddjvu_document_t *document);
+QImage renderDjvuThumbnail(ddjvu_document_t *document, int pageNum, const QSize &box);
+
+// Takes the image by value so a caller that moves it in avoids a copy. Large
+// images are processed in parallel bands.
+QImage applyNightMode(QImage image, int warmthLevel);
+
+}
@@ -0,0 +1,501 @@
+#include "pageview.h"
+
+#include <QPainter>
+#include <QScrollBar>
+
+#include <algorithm>
+
+PageView::PageView(RenderService *service, QWidget *parent)
+    : QAbstractScrollArea(parent), service(service)
+{
+    viewport()->setMouseTracking(true);
+
+    connect(service, &RenderService::pageReady, this, [this](int page, const RenderParams &params, const QImage &image) {
+        onPageRendered(page, params, image, false);
+    });
+    connect(service, &RenderService::previewReady, this, [this](int page, const RenderParams &params, const QImage &image) {
+        onPageRendered(page, params, image, true);
+    });
+    connect(service, &RenderService::tileReady, this, [this](int page, const QRect &tile, const RenderParams &params) {
+        if (params != renderParams)
+            return;
+        for (const PageItem &item : items) {
+            if (item.tiled && item.page == page)
+                viewport()->update(toViewport(fromPixels(tile).translated(item.rect.topLeft()).toAlignedRect()));
+        }
+    });
+}
+
+void PageView::clear(const QString &text) {
+    message = text;
+    items.clear();
+    content = QSize();
+    highlightPage = -1;
+    highlights.clear();
+    selecting = false;
+    selectionPage = -1;
+    selection.clear();
+    updateScrollBars();
+    viewport()->update();
+}
+
+void PageView::showSinglePage(int pageNum, const RenderParams &params, bool tiled) {
+    PageItem item;
+    item.page = pageNum;
+    item.tiled = tiled;
+    item.pixelSize = service->pageDisplaySize(pageNum, params);
+    setItems({item}, params, Qt::Horizontal);
+}
+
+void PageView::showSpread(const QVector<int> &pages, const RenderParams &params) {
+    QVector<PageItem> spread;
+    for (int pageNum : pages) {
+        PageItem item;
+        item.page = pageNum;
+        item.pixelSize = service->pageDisplaySize(pageNum, params);
+        spread.append(item);
+    }
+    setItems(spread, params, Qt::Horizontal);
+}
+
+void PageView::showContinuous(int pageCount, const RenderParams &params) {
+    QVector<PageItem> pages;
+    pages.reserve(pageCount);
+    for (int i = 0; i < pageCount; ++i) {
+        PageItem item;
+        item.page = i;
+        item.pixelSize = service->pageDisplaySize(i, params);
+        pages.append(item);
+    }
+    setItems(pages, params, Qt::Vertical);
+}
+
+void PageView::scrollToPage(int pageNum) {
+    for (const PageItem &item : items) {
+        if (item.page == pageNum) {
+            verticalScrollBar()->setValue(item.rect.top());
+            return;
+        }
+    }
+}
+
+void PageView::setHighlights(int pageNum, const QVector<QRectF> &rects) {
+    highlightPage = pageNum;
+    highlights = rects;
+    viewport()->update();
+}
+
+void PageView::setSelection(int pageNum, const QVector<QRectF> &rects) {
+    selectionPage = pageNum;
+    selection = rects;
+    viewport()->update();
+}
+
+void PageView::clearSelection() {
+    selecting = false;
+    setSelection(-1, QVector<QRectF>());
+}
+
+QPointF PageView::centerRatio() const {
+    if (content.isEmpty())
+        return QPointF(0.5, 0.5);
+
+    QPoint center = viewport()->rect().center() - origin();
+    return QPointF(static_cast<double>(center.x()) / content.width(),
+                   static_cast<double>(center.y()) / content.height());
+}
+
+void PageView::setCenterRatio(const QPointF &ratio) {
+    horizontalScrollBar()->setValue(static_cast<int>(content.width() * ratio.x()) - viewport()->width() / 2);
+    verticalScrollBar()->setValue(static_cast<int>(content.height() * ratio.y()) - viewport()->height() / 2);
+}
+
+void PageView::setItems(QVector<PageItem> newItems, const RenderParams &params, Qt::Orientation orientation) {
+    // Pages are placed side by side (spreads) or stacked (continuous scroll),
+    // each centred across the other axis.
+    int along = 0;
+    int across = 0;
+    for (PageItem &item : newItems) {
+        item.rect = QRect(QPoint(0, 0), (QSizeF(item.pixelSize) / params.devicePixelRatio).toSize());
+        if (orientation == Qt::Horizontal) {
+            item.rect.moveTopLeft(QPoint(along, 0));
+            along += item.rect.width();
+            across = std::max(across, item.rect.height());
+        } else {
+            if (along > 0)
+                along += PageSpacing;
+            item.rect.moveTopLeft(QPoint(0, along));
+            along += item.rect.height();
+            across = std::max(across, item.rect.width());
+        }
+    }
+    for (PageItem &item : newItems) {
+        if (orientation == Qt::Horizontal)
+            item.rect.moveTop((across - item.rect.height()) / 2);
+        else
+            item.rect.moveLeft((across - item.rect.width()) / 2);
+    }
+
+    bool samePages = newItems.size() == items.size();
+    for (int i = 0; samePages && i < items.size(); ++i)
+        samePages = newItems[i].page == items[i].page;
+
+    // A relayout of the same stack keeps the page at the top of the viewport
+    // where it was, even when pages above it changed size.
+    int anchor = -1;
+    double anchorOffset = 0.0;
+    if (samePages && virtualized && orientation == Qt::Vertical && firstVisible >= 0) {
+        anchor = firstVisible;
+        const QRect &rect = items[anchor].rect;
+        int top = viewport()->rect().top() - origin().y();
+        anchorOffset = rect.height() > 0 ? double(top - rect.top()) / rect.height() : 0.0;
+    }
+
+    // Keep what is already on screen when only the layout changed; otherwise
+    // start from whatever the render service has cached. Stacked pages are
+    // only filled in once they come near the viewport.
+    bool sameParams = params == renderParams;
+    virtualized = orientation == Qt::Vertical;
+    for (int i = 0; i < newItems.size(); ++i) {
+        PageItem &item = newItems[i];
+        if (item.tiled)
+            continue;
+        if (samePages && sameParams && !items[i].tiled) {
+            item.image = items[i].image;
+            item.preview = items[i].preview;
+            continue;
+        }
+        if (virtualized)
+            continue;
+        item.image = service->renderedPage(item.page, params);
+        if (item.image.isNull())
+            item.preview = service->previewPage(item.page, params);
+    }
+
+    items = newItems;
+    renderParams = params;
+    content = orientation == Qt::Horizontal ? QSize(along, across) : QSize(across, along);
+    message.clear();
+
+    updateScrollBars();
+    if (!samePages) {
+        selecting = false;
+        selectionPage = -1;
+        selection.clear();
+        horizontalScrollBar()->setValue(0);
+        verticalScrollBar()->setValue(0);
+    } else if (anchor >= 0) {
+        const QRect &rect = items[anchor].rect;
+        verticalScrollBar()->setValue(rect.top() + qRound(anchorOffset * rect.height()));
+    }
+    firstVisible = -1;
+    lastVisible = -1;
+    updateVisiblePages();
+    requestVisibleTiles();
+    viewport()->update();
+}
+
+void PageView::updateVisiblePages() {
+    if (!virtualized || items.isEmpty())
+        return;
+
+    // Items are stacked top to bottom, so the visible ones are found by bisection.
+    QRect visible = viewport()->rect().translated(-origin());
+    auto firstItem = std::lower_bound(items.begin(), items.end(), visible.top(), [](const PageItem &item, int top) {
+        return item.rect.bottom() < top;
+    });
+    int first = std::min(static_cast<int>(firstItem - items.begin()), static_cast<int>(items.size()) - 1);
+    int last = first;
+    while (last + 1 < items.size() && items[last + 1].rect.top() <= visible.bottom())
+        ++last;
+
+    if (first == firstVisible && last == lastVisible)
+        return;
+    firstVisible = first;
+    lastVisible = last;
+
+    // Pages near the viewport take their images from the cache; pages that
+    // scrolled far away let theirs go so memory doesn't grow with the book.
+    int keep = service->prefetchDistance() + KeepMargin;
+    QVector<int> visiblePages;
+    for (int i = 0; i < items.size(); ++i) {
+        PageItem &item = items[i];
+        if (i < first - keep || i > last + keep) {
+            item.image = QImage();
+            item.preview = QImage();
+            continue;
+        }
+        if (item.image.isNull()) {
+            item.image = service->renderedPage(item.page, renderParams);
+            if (!item.image.isNull())
+                item.preview = QImage();
+            else if (item.preview.isNull())
+                item.preview = service->previewPage(item.page, renderParams);
+        }
+        if (i >= first && i <= last)
+            visiblePages.append(item.page);
+    }
+
+    // The render service prefetches around these and cancels what scrolled away.
+    service->requestPages(visiblePages, renderParams);
+    emit currentPageChanged(items[first].page);
+}
+
+void PageView::updateScrollBars() {
+    QSize area = viewport()->size();
+    horizontalScrollBar()->setRange(0, std::max(0, content.width() - area.width()));
+    horizontalScrollBar()->setPageStep(area.width());
+    horizontalScrollBar()->setSingleStep(20);
+    verticalScrollBar()->setRange(0, std::max(0, content.height() - area.height()));
+    verticalScrollBar()->setPageStep(area.height());
+    verticalScrollBar()->setSingleStep(20);
+}
+
+QPoint PageView::origin() const {
+    // Content smaller than the viewport is centred in it.
+    QSize area = viewport()->size();
+    return QPoint(std::max(0, (area.width() - content.width()) / 2) - horizontalScrollBar()->value(),
+                  std::max(0, (area.height() - content.height()) / 2) - verticalScrollBar()->value());
+}
+
+QRect PageView::toViewport(const QRect &contentRect) const {
+    return contentRect.translated(origin());
+}
+
+QRectF PageView::toPixels(const QRect &rect) const {
+    qreal ratio = renderParams.devicePixelRatio;
+    return QRectF(rect.x() * ratio, rect.y() * ratio, rect.width() * ratio, rect.height() * ratio);
+}
+
+QRectF PageView::fromPixels(const QRect &rect) const {
+    qreal ratio = renderParams.devicePixelRatio;
+    return QRectF(rect.x() / ratio, rect.y() / ratio, rect.width() / ratio, rect.height() / ratio);
+}
+
+const PageView::PageItem *PageView::itemAt(const QPoint &viewportPos) const {
+    QPoint pos = viewportPos - origin();
+    for (const PageItem &item : items) {
+        if (item.rect.contains(pos))
+            return &item;
+    }
+    return nullptr;
+}
+
+const PageView::PageItem *PageView::itemFor(int pageNum) const {
+    for (const PageItem &item : items) {
+        if (item.page == pageNum)
+            return &item;
+    }
+    return nullptr;
+}
+
+QPointF PageView::toPage(const PageItem &item, const QPoint &viewportPos) const {
+    QRect target = toViewport(item.rect);
+    return QPointF(std::clamp(static_cast<double>(viewportPos.x() - target.left()) / target.width(), 0.0, 1.0),
+                   std::clamp(static_cast<double>(viewportPos.y() - target.top()) / target.height(), 0.0, 1.0));
+}
+
+QRect PageView::toViewport(const PageItem &item, const QRectF &pageRect) const {
+    QRect target = toViewport(item.rect);
+    return QRect(target.left() + int(pageRect.left() * target.width()),
+                 target.top() + int(pageRect.top() * target.height()),
+                 int(pageRect.width() * target.width()), int(pageRect.height() * target.height()));
+}
+
+void PageView::paintEvent(QPaintEvent *event) {
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), QColor("#1a1a1a"));
+    QVector<int> shownPages;
+
+    if (items.isEmpty()) {
+        painter.setPen(palette().color(QPalette::WindowText));
+        painter.drawText(viewport()->rect(), Qt::AlignCenter, message);
+        return;
+    }
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    for (const PageItem &item : items) {
+        QRect target = toViewport(item.rect);
+        QRect exposed = target & event->rect();
+        if (exposed.isEmpty())
+            continue;
+
+        bool shown = true;
+        if (item.tiled) {
+            shown = paintTiles(painter, item, target, exposed);
+        } else if (!item.image.isNull()) {
+            painter.drawImage(QRectF(exposed), item.image, toPixels(exposed.translated(-target.topLeft())));
+        } else if (!item.preview.isNull()) {
+            // Stretch the coarse render to the final size so the refine doesn't jump.
+            painter.drawImage(target, item.preview);
+        } else {
+            shown = false;
+        }
+        if (shown)
+            shownPages.append(item.page);
+
+        if (item.page == highlightPage && !highlights.isEmpty()) {
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(QColor(255, 255, 0, 128)); // semi-transparent yellow
+            for (const QRectF &rect : highlights) {
+                QRect scaledRect = toViewport(item, rect);
+                if (scaledRect.intersects(exposed))
+                    painter.drawRoundedRect(scaledRect, 3, 3);
+            }
+        }
+
+        if (item.page == selectionPage) {
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(QColor(0, 120, 215, 96));
+            for (const QRectF &rect : selection) {
+                QRect scaledRect = toViewport(item, rect);
+                if (scaledRect.intersects(exposed))
+                    painter.drawRect(scaledRect);
+            }
+            if (selecting) {
+                painter.setPen(QPen(QColor(0, 120, 215), 1, Qt::DashLine));
+                painter.setBrush(Qt::NoBrush);
+                painter.drawRect(toViewport(item, selectionBand));
+            }
+        }
+    }
+    painter.end();
+
+    for (int pageNum : shownPages)
+        emit pageShown(pageNum);
+}
+
+bool PageView::paintTiles(QPainter &painter, const PageItem &item, const QRect &target, const QRect &exposed) {
+    bool painted = false;
+    QRect area = toPixels(exposed.translated(-target.topLeft())).toAlignedRect();
+    for (const QRect &tile : tilesIn(area, item.pixelSize)) {
+        QImage image = service->renderedTile(item.page, tile, renderParams);
+        if (!image.isNull()) {
+            painter.drawImage(fromPixels(tile).translated(target.topLeft()), image);
+            painted = true;
+        }
+    }
+    return painted;
+}
+
+void PageView::requestVisibleTiles() {
+    for (const PageItem &item : items) {
+        if (item.tiled)
+            requestVisibleTiles(item, toViewport(item.rect));
+    }
+}
+
+void PageView::requestVisibleTiles(const PageItem &item, const QRect &target) {
+    // Visible tiles first, then a one-tile margin so short scrolls find them ready.
+    // The whole visible area is requested, not just the exposed rect, since tiles
+    // left out of the request are cancelled.
+    QRect visible = toPixels((viewport()->rect() & target).translated(-target.topLeft())).toAlignedRect();
+    QRect margin = visible.adjusted(-TileSize, -TileSize, TileSize, TileSize);
+    QVector<QRect> around;
+    for (const QRect &tile : tilesIn(margin, item.pixelSize)) {
+        if (!tile.intersects(visible))
+            around.append(tile);
+    }
+    service->requestTiles(item.page, tilesIn(visible, item.pixelSize), around, renderParams);
+}
+
+QVector<QRect> PageView::tilesIn(const QRect &area, const QSize &pageSize) const {
+    QVector<QRect> tiles;
+    QRect bounded = area & QRect(QPoint(0, 0), pageSize);
+    if (bounded.isEmpty())
+        return tiles;
+
+    for (int y = bounded.top() / TileSize * TileSize; y <= bounded.bottom(); y += TileSize) {
+        for (int x = bounded.left() / TileSize * TileSize; x <= bounded.right(); x += TileSize)
+            tiles.append(QRect(x, y, TileSize, TileSize) & QRect(QPoint(0, 0), pageSize));
+    }
+    return tiles;
+}
+
+void PageView::onPageRendered(int pageNum, const RenderParams &params, const QImage &image, bool preview) {
+    if (params != renderParams)
+        return;
+
+    for (PageItem &item : items) {
+        if (item.page != pageNum || item.tiled)
+            continue;
+        if (preview) {
+            if (!item.image.isNull())
+                continue;
+            item.preview = image;
+        } else {
+            item.image = image;
+            item.preview = QImage();
+        }
+        viewport()->update(toViewport(item.rect));
+    }
+}
+
+void PageView::resizeEvent(QResizeEvent *event) {
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+    updateVisiblePages();
+    requestVisibleTiles();
+}
+
+void PageView::scrollContentsBy(int dx, int dy) {
+    viewport()->scroll(dx, dy);
+    updateVisiblePages();
+    requestVisibleTiles();
+}
+
+void PageView::mousePressEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton && (event->modifiers() & Qt::ShiftModifier)) {
+        const PageItem *item = itemAt(event->pos());
+        if (!item)
+            return;
+        selecting = true;
+        selectionPage = item->page;
+        selection.clear();
+        selectionStart = toPage(*item, event->pos());
+        selectionBand = QRectF(selectionStart, QSizeF());
+        viewport()->setCursor(Qt::IBeamCursor);
+        viewport()->update();
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton) {
+        dragging = true;
+        lastPos = event->pos();
+        viewport()->setCursor(Qt::ClosedHandCursor);
+    }
+}
+
+void PageView::mouseMoveEvent(QMouseEvent *event) {
+    if (selecting) {
+        const PageItem *item = itemFor(selectionPage);
+        if (!item)
+            return;
+        selectionBand = QRectF(selectionStart, toPage(*item, event->pos())).normalized();
+        viewport()->update(toViewport(item->rect));
+        emit selectionChanged(selectionPage, selectionBand);
+        return;
+    }
+
+    if (dragging) {
+        QPoint delta = event->pos() - lastPos;
+        lastPos = event->pos();
+
+        horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
+        verticalScrollBar()->setValue(verticalScrollBar()->value() - delta.y());
+    }
+}
+
+void PageView::mouseReleaseEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton && selecting) {
+        selecting = false;
+        viewport()->setCursor(Qt::ArrowCursor);
+        viewport()->update();
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton) {
+        dragging = false;
+        viewport()->setCursor(Qt::ArrowCursor);
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <QAbstractScrollArea>
+#include <QHash>
+#include <QImage>
+#include <QMouseEvent>
+#include <QPaintEvent>
+#include <QVector>
+
+#include "renderservice.h"
+
+// The document viewport. Pages are laid out once per view change and painted
+// straight from their rendered images or tiles, so page turns don't recreate
+// widgets and a finished render only repaints the page it belongs to.
+// Dragging with the left button pans the view; with Shift held it drags a
+// selection rectangle instead.
+//
+// Continuous scroll is virtualized: every page gets a placeholder sized from
+// its geometry, but only the pages in and near the viewport are requested
+// and kept in memory.
+class PageView : public QAbstractScrollArea {
+    Q_OBJECT
+
+public:
+    static constexpr int TileSize = 512;
+    static constexpr int PageSpacing = 10;
+
+    explicit PageView(RenderService *service, QWidget *parent = nullptr);
+
+    // Shows the message instead of any pages.
+    void clear(const QString &message = QString());
+
+    // A tiled page only renders the tiles around the visible area; used when
+    // zoomed so far that rendering the whole page would be wasteful.
+    void showSinglePage(int pageNum, const RenderParams &params, bool tiled);
+    void showSpread(const QVector<int> &pages, const RenderParams &params);
+    // Showing the same pages again keeps the scroll position.
+    void showContinuous(int pageCount, const RenderParams &params);
+    void scrollToPage(int pageNum);
+
+    // Highlight rectangles in page coordinates normalized to 0..1; replaces
+    // any highlights shown before.
+    void setHighlights(int pageNum, const QVector<QRectF> &rects);
+
+    // Selected word boxes, in the same coordinates as highlights.
+    void setSelection(int pageNum, const QVector<QRectF> &rects);
+    void clearSelection();
+
+    // Position of the viewport centre as a fraction of the content size.
+    QPointF centerRatio() const;
+    void setCenterRatio(const QPointF &ratio);
+
+signals:
+    // Continuous scroll: the first page in the viewport changed.
+    void currentPageChanged(int pageNum);
+
+    // Some image of the page (preview, full render or a tile) was painted;
+    // used to time how long a page takes to appear.
+    void pageShown(int pageNum);
+
+    // The selection rectangle moved; rect is normalized to the page it
+    // started on. The owner answers with setSelection().
+    void selectionChanged(int pageNum, const QRectF &rect);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+
+private:
+    struct PageItem {
+        int page = -1;
+        QSize pixelSize; // rendered size in device pixels
+        QRect rect;      // content coordinates, in logical pixels
+        bool tiled = false;
+        QImage image;
+        QImage preview;
+    };
+
+    void setItems(QVector<PageItem> newItems, const RenderParams &params, Qt::Orientation orientation);
+    void updateScrollBars();
+    void updateVisiblePages();
+    QPoint origin() const;
+    QRect toViewport(const QRect &contentRect) const;
+
+    // Conversions between logical widget pixels and rendered device pixels.
+    QRectF toPixels(const QRect &rect) const;
+    QRectF fromPixels(const QRect &rect) const;
+
+    const PageItem *itemAt(const QPoint &viewportPos) const;
+    const PageItem *itemFor(int pageNum) const;
+    QPointF toPage(const PageItem &item, const QPoint &viewportPos) const;
+    QRect toViewport(const PageItem &item, const QRectF &pageRect) const;
+
+    // False if none of the exposed tiles is rendered yet.
+    bool paintTiles(QPainter &painter, const PageItem &item, const QRect &target, const QRect &exposed);
+    // Called when the view moves or changes, never while painting.
+    void requestVisibleTiles();
+    void requestVisibleTiles(const PageItem &item, const QRect &target);
+    QVector<QRect> tilesIn(const QRect &area, const QSize &pageSize) const;
+
+    void onPageRendered(int pageNum, const RenderParams &params, const QImage &image, bool preview);
+
+    RenderService *service;
+    RenderParams renderParams;
+    QVector<PageItem> items;
+    QSize content;
+    QString message;
+
+    bool virtualized = false;
+    int firstVisible = -1;
+    int lastVisible = -1;
+
+    // Pages further than this beyond the prefetch distance drop their images.
+    static constexpr int KeepMargin = 4;
+
+    int highlightPage = -1;
+    QVector<QRectF> highlights;
+
+    int selectionPage = -1;
+    QVector<QRectF> selection;
+    bool selecting = false;
+    QPointF selectionStart; // normalized, on selectionPage
+    QRectF selectionBand;
+
+    bool dragging = false;
+    QPoint lastPos;
+};
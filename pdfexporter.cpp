@@ -0,0 +1,199 @@
+#include "pdfexporter.h"
+
+#include <QMutexLocker>
+#include <QPageSize>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QSaveFile>
+
+#include <algorithm>
+
+PdfExporter::PdfExporter(DjvuBackend *djvu, QObject *parent)
+    : QObject(parent), djvu(djvu)
+{
+}
+
+PdfExporter::~PdfExporter() {
+    cancel();
+    for (auto &thread : threads)
+        thread->wait();
+    if (document)
+        ddjvu_document_release(document);
+}
+
+void PdfExporter::start(const QString &djvuPath, const QString &pdfPath) {
+    if (isRunning())
+        return;
+
+    cancelled = false;
+    nextPage = 0;
+    written = 0;
+    rendered.clear();
+    reservedBytes = 0;
+    error.clear();
+
+    document = ddjvu_document_create_by_filename(djvu->context(), djvuPath.toUtf8().data(), TRUE);
+    if (!document) {
+        emit finished(false, "Could not open " + djvuPath);
+        return;
+    }
+
+    // One thread is left for the writer and one for the GUI.
+    int workers = std::max(1, QThread::idealThreadCount() - 2);
+    for (int i = 0; i < workers; ++i)
+        threads.emplace_back(QThread::create([this]() { renderPages(); }));
+    threads.emplace_back(QThread::create([this, pdfPath]() { writePages(pdfPath); }));
+    for (auto &thread : threads)
+        thread->start();
+}
+
+void PdfExporter::cancel() {
+    cancelled = true;
+    QMutexLocker locker(&mutex);
+    pageRendered.wakeAll();
+    pageWritten.wakeAll();
+}
+
+void PdfExporter::fail(const QString &message) {
+    QMutexLocker locker(&mutex);
+    if (error.isEmpty())
+        error = message;
+    cancelled = true;
+    pageRendered.wakeAll();
+    pageWritten.wakeAll();
+}
+
+void PdfExporter::renderPages() {
+    if (!djvu->waitForDocument(document, &cancelled)) {
+        if (!cancelled)
+            fail("The document could not be decoded.");
+        return;
+    }
+
+    int pages = ddjvu_document_get_pagenum(document);
+    for (int i = nextPage++; i < pages && !cancelled; i = nextPage++) {
+        // A native-resolution render is RGB32 until it is converted, so that
+        // is what it reserves; a 600 dpi colour page is well over 100 MB.
+        ddjvu_pageinfo_t info;
+        qint64 estimate = djvu->pageInfo(document, i, &info, &cancelled)
+                              ? static_cast<qint64>(info.width) * info.height * 4 : 0;
+        {
+            // Pages are taken in order, so the one the writer needs next is
+            // never held up here.
+            QMutexLocker locker(&mutex);
+            while (i != written && reservedBytes + estimate > MemoryBudget && !cancelled)
+                pageWritten.wait(&mutex);
+            reservedBytes += estimate;
+        }
+        if (cancelled)
+            break;
+
+        RenderedPage result;
+        ddjvu_page_t *page = ddjvu_page_create_by_pageno(document, i);
+        if (page && djvu->waitForPage(page, &cancelled)) {
+            result.dpi = ddjvu_page_get_resolution(page);
+            result.image = PageRenderer::renderDjvu(page, 1.0, &cancelled);
+            // At its native resolution a bitonal page is pure black and white;
+            // one bit per pixel keeps it small in the window and in the PDF.
+            if (ddjvu_page_get_type(page) == DDJVU_PAGETYPE_BITONAL && !result.image.isNull())
+                result.image = result.image.convertToFormat(QImage::Format_Mono, Qt::ThresholdDither);
+        }
+        if (page)
+            ddjvu_page_release(page);
+
+        if (cancelled)
+            break;
+        if (result.image.isNull()) {
+            fail(QString("Page %1 could not be rendered.").arg(i + 1));
+            break;
+        }
+
+        // From here on the page only holds what it takes after conversion.
+        QMutexLocker locker(&mutex);
+        reservedBytes += result.image.sizeInBytes() - estimate;
+        rendered.insert(i, std::move(result));
+        pageRendered.wakeAll();
+        pageWritten.wakeAll();
+    }
+}
+
+void PdfExporter::writePages(const QString &pdfPath) {
+    bool completed = false;
+    if (!djvu->waitForDocument(document, &cancelled)) {
+        if (!cancelled)
+            fail("The document could not be decoded.");
+    } else if (ddjvu_document_get_pagenum(document) <= 0) {
+        fail("The document has no pages.");
+    } else {
+        int pages = ddjvu_document_get_pagenum(document);
+
+        // A cancelled or failed export leaves an existing file untouched.
+        QSaveFile file(pdfPath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            fail("Could not write " + pdfPath);
+        } else {
+            // At 72 dpi the painter works in points, and images keep their
+            // own pixels whatever size they are drawn at.
+            QPdfWriter writer(&file);
+            writer.setResolution(72);
+            writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+            QPainter painter;
+
+            int i = 0;
+            for (; i < pages; ++i) {
+                RenderedPage page;
+                {
+                    QMutexLocker locker(&mutex);
+                    while (!rendered.contains(i) && !cancelled)
+                        pageRendered.wait(&mutex);
+                    if (cancelled)
+                        break;
+                    page = rendered.take(i);
+                    written = i + 1;
+                    reservedBytes -= page.image.sizeInBytes();
+                    pageWritten.wakeAll();
+                }
+
+                int dpi = page.dpi > 0 ? page.dpi : 300;
+                QSizeF size(page.image.width() * 72.0 / dpi, page.image.height() * 72.0 / dpi);
+                writer.setPageSize(QPageSize(size, QPageSize::Point, QString(), QPageSize::ExactMatch));
+                if (i == 0)
+                    painter.begin(&writer);
+                else
+                    writer.newPage();
+                painter.drawImage(QRectF(QPointF(0, 0), size), page.image);
+
+                QMetaObject::invokeMethod(this, [this, i, pages]() {
+                    emit progress(i + 1, pages);
+                }, Qt::QueuedConnection);
+            }
+            if (painter.isActive())
+                painter.end();
+
+            completed = i == pages && !cancelled;
+            if (completed && !file.commit()) {
+                completed = false;
+                fail("Could not write " + pdfPath);
+            }
+            if (!completed)
+                file.cancelWriting();
+        }
+    }
+
+    QMetaObject::invokeMethod(this, [this, completed]() {
+        wrapUp(completed);
+    }, Qt::QueuedConnection);
+}
+
+void PdfExporter::wrapUp(bool completed) {
+    // The writer only finishes once the workers can't get any further.
+    cancel();
+    for (auto &thread : threads)
+        thread->wait();
+    threads.clear();
+    rendered.clear();
+    ddjvu_document_release(document);
+    document = nullptr;
+
+    emit finished(completed, error);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QImage>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "djvubackend.h"
+
+// Converts a DjVu document to PDF off the GUI thread. Several workers
+// decode and render pages at their native resolution, a reorder queue
+// bounded by bytes holds what they finish out of order, and a single
+// writer paints the pages into the PDF in sequence, each at the size and
+// resolution of its source page. The PDF only replaces the target file
+// once complete.
+class PdfExporter : public QObject {
+    Q_OBJECT
+public:
+    explicit PdfExporter(DjvuBackend *djvu, QObject *parent = nullptr);
+    // Cancels a running export and waits for its threads.
+    ~PdfExporter();
+
+    // Opens a document of its own, so the viewed one can change meanwhile.
+    void start(const QString &djvuPath, const QString &pdfPath);
+    void cancel();
+    bool isRunning() const { return !threads.empty(); }
+
+signals:
+    void progress(int writtenPages, int totalPages);
+    // error is empty on success and when cancelled.
+    void finished(bool completed, const QString &error);
+
+private:
+    struct RenderedPage {
+        QImage image;
+        int dpi = 0;
+    };
+
+    // Rendered pages waiting for the writer, and renders in progress, may
+    // hold at most this much; the page the writer needs next always goes.
+    static constexpr qint64 MemoryBudget = 512ll * 1024 * 1024;
+
+    void renderPages();
+    void writePages(const QString &pdfPath);
+    void fail(const QString &message);
+    void wrapUp(bool completed);
+
+    DjvuBackend *djvu;
+    ddjvu_document_t *document = nullptr;
+    std::vector<std::unique_ptr<QThread>> threads;
+
+    PageRenderer::CancelFlag cancelled{false};
+    std::atomic<int> nextPage{0};
+
+    QMutex mutex;
+    QWaitCondition pageRendered;
+    QWaitCondition pageWritten;
+    QMap<int, RenderedPage> rendered;
+    int written = 0;
+    qint64 reservedBytes = 0;
+    QString error;
+};
@@ -0,0 +1,401 @@
+#include "renderservice.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include <algorithm>
+#include <utility>
+
+RenderService::RenderService(DjvuBackend *djvu, QObject *parent)
+    : QObject(parent), djvu(djvu), djvuPages(djvu)
+{
+    pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+RenderService::~RenderService() {
+    clearDocument();
+}
+
+void RenderService::setDjvuDocument(ddjvu_document_t *document, const QString &filePath, int pages) {
+    clearDocument();
+    djvuDoc = document;
+    djvuPages.setDocument(document);
+    documentPath = filePath;
+    isPdf = false;
+    pageCount = pages;
+    pageSizes.fill(QSizeF(), pages);
+}
+
+void RenderService::setPdfDocument(const QString &filePath, const QVector<QSizeF> &sizes) {
+    clearDocument();
+    documentPath = filePath;
+    isPdf = true;
+    pageCount = sizes.size();
+    pageSizes = sizes;
+}
+
+void RenderService::clearDocument() {
+    // Workers read the document handles, so they must be idle before those change.
+    // Running renders are cancelled so this only waits for their current band.
+    pool.clear();
+    for (auto it = inFlight.begin(); it != inFlight.end(); ++it)
+        it.value()->cancelled = true;
+    pool.waitForDone();
+    ++documentSerial;
+
+    // Cached images stay: their keys name the document, so reopening it hits.
+    djvuDoc = nullptr;
+    djvuPages.clear();
+    documentPath.clear();
+    isPdf = false;
+    pageCount = 0;
+    pageSizes.clear();
+    pendingPageSizes.clear();
+    pageSizeWaiting = false;
+    placeholderSize = QSizeF();
+
+    inFlight.clear();
+    wanted.clear();
+
+    QMutexLocker locker(&pdfMutex);
+    idlePdfDocs.clear();
+}
+
+void RenderService::setThreadCount(int threads) {
+    pool.setMaxThreadCount(std::max(1, threads));
+}
+
+void RenderService::setPrefetchDistance(int pages) {
+    prefetch = std::max(0, pages);
+}
+
+QImage RenderService::renderedPage(int pageNum, const RenderParams &params) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return QImage();
+    return cache.find(cacheKey(pageNum, params));
+}
+
+QImage RenderService::previewPage(int pageNum, const RenderParams &params) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return QImage();
+
+    PageKey key = cacheKey(pageNum, params);
+    key.preview = true;
+    return cache.peek(key);
+}
+
+QSize RenderService::pageDisplaySize(int pageNum, const RenderParams &params) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return QSize();
+    return cacheKey(pageNum, params).size;
+}
+
+void RenderService::requestPage(int pageNum, const RenderParams &params) {
+    requestPages({pageNum}, params);
+}
+
+void RenderService::requestPages(const QVector<int> &pages, const RenderParams &params) {
+    if (documentPath.isEmpty() || pages.isEmpty())
+        return;
+
+    ++generation;
+    wanted.clear();
+    for (int pageNum : pages) {
+        schedulePreview(pageNum, params);
+        schedule(pageNum, params, prefetch + 2);
+    }
+
+    int first = *std::min_element(pages.begin(), pages.end());
+    int last = *std::max_element(pages.begin(), pages.end());
+    for (int d = 1; d <= prefetch; ++d) {
+        // Reading forward is more common, so the page ahead goes first.
+        schedule(last + d, params, prefetch - d + 1);
+        schedule(first - d, params, prefetch - d);
+    }
+
+    cancelUnwantedPages();
+}
+
+PageKey RenderService::cacheKey(int pageNum, const RenderParams &params) {
+    PageKey key;
+    key.document = documentPath;
+    key.page = pageNum;
+    key.nightMode = params.nightMode;
+    key.warmthLevel = params.nightMode ? params.warmthLevel : 0;
+    key.backend = isPdf ? PageKey::Pdf : PageKey::Djvu;
+
+    QSizeF size = pageSize(pageNum);
+    key.scale = PageRenderer::pageScale(size, params);
+    key.size = PageRenderer::scaledPageSize(size, key.scale);
+    return key;
+}
+
+PageKey RenderService::tileKey(int pageNum, const QRect &tile, const RenderParams &params) {
+    PageKey key = cacheKey(pageNum, params);
+    key.tile = tile;
+    return key;
+}
+
+QImage RenderService::renderedTile(int pageNum, const QRect &tile, const RenderParams &params) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return QImage();
+    return cache.peek(tileKey(pageNum, tile, params));
+}
+
+void RenderService::requestTiles(int pageNum, const QVector<QRect> &visible, const QVector<QRect> &around,
+                                 const RenderParams &params) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return;
+
+    ++generation;
+    QSet<PageKey> keep;
+    auto request = [&](const QVector<QRect> &tiles, int priority) {
+        for (const QRect &tile : tiles) {
+            PageKey key = tileKey(pageNum, tile, params);
+            keep.insert(key);
+            if (!cache.touch(key) && !inFlight.contains(key))
+                start(key, params, priority);
+        }
+    };
+    request(visible, prefetch + 3);
+    request(around, 0);
+
+    cancelUnwantedTiles(keep);
+}
+
+QSizeF RenderService::pageSize(int pageNum) {
+    // PDF sizes all come with the document; a page Poppler can't read has none.
+    QSizeF &size = pageSizes[pageNum];
+    if (size.isValid() || isPdf)
+        return size;
+
+    // Letter at 300 dpi until any page is known.
+    QSizeF shown = placeholderSize.isValid() ? placeholderSize : QSizeF(2550, 3300);
+
+    ddjvu_pageinfo_t info;
+    ddjvu_status_t status = ddjvu_document_get_pageinfo(djvuDoc, pageNum, &info);
+    if (status == DDJVU_JOB_OK) {
+        size = QSizeF(info.width, info.height);
+        if (!placeholderSize.isValid())
+            placeholderSize = size;
+        return size;
+    }
+    if (status < DDJVU_JOB_OK && !pendingPageSizes.contains(pageNum)) {
+        pendingPageSizes.insert(pageNum, shown);
+        waitForPageSizes();
+    }
+    return shown;
+}
+
+void RenderService::waitForPageSizes() {
+    // One waiter at a time, on the lowest page still pending: libdjvu
+    // describes pages in order, so the others tend to be ready right after.
+    if (pageSizeWaiting || pendingPageSizes.isEmpty())
+        return;
+    pageSizeWaiting = true;
+
+    ddjvu_document_t *document = djvuDoc;
+    int pageNum = pendingPageSizes.firstKey();
+    int serial = documentSerial;
+    djvu->when([document, pageNum]() {
+            ddjvu_pageinfo_t info;
+            return ddjvu_document_get_pageinfo(document, pageNum, &info);
+        }, document)
+        .then(this, [this, serial](bool) {
+            if (serial != documentSerial)
+                return;
+            pageSizeWaiting = false;
+            collectPageSizes();
+        });
+}
+
+void RenderService::collectPageSizes() {
+    bool changed = false;
+    for (auto it = pendingPageSizes.begin(); it != pendingPageSizes.end();) {
+        ddjvu_pageinfo_t info;
+        ddjvu_status_t status = ddjvu_document_get_pageinfo(djvuDoc, it.key(), &info);
+        if (status < DDJVU_JOB_OK)
+            break;
+        // A page without info keeps its placeholder.
+        if (status == DDJVU_JOB_OK) {
+            QSizeF size(info.width, info.height);
+            pageSizes[it.key()] = size;
+            if (!placeholderSize.isValid())
+                placeholderSize = size;
+            changed = changed || size != it.value();
+        }
+        it = pendingPageSizes.erase(it);
+    }
+
+    if (changed)
+        emit pageSizesChanged();
+    waitForPageSizes();
+}
+
+void RenderService::schedule(int pageNum, const RenderParams &params, int priority) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return;
+
+    PageKey key = cacheKey(pageNum, params);
+    wanted.insert(pageNum, key);
+    if (cache.contains(key) || inFlight.contains(key))
+        return;
+    start(key, params, priority);
+}
+
+void RenderService::schedulePreview(int pageNum, const RenderParams &params) {
+    if (pageNum < 0 || pageNum >= pageCount)
+        return;
+
+    PageKey key = cacheKey(pageNum, params);
+    if (cache.contains(key))
+        return;
+
+    key.preview = true;
+    if (cache.contains(key) || inFlight.contains(key))
+        return;
+    start(key, params, prefetch + 3);
+}
+
+void RenderService::start(const PageKey &key, const RenderParams &params, int priority) {
+    auto job = std::make_shared<RenderJob>();
+    job->generation = generation;
+    inFlight.insert(key, job);
+
+    int serial = documentSerial;
+    pool.start([this, key, params, job, serial]() {
+        // A job cancelled while still queued costs nothing more than this check.
+        if (job->cancelled)
+            return;
+        QImage image = render(key, params, &job->cancelled);
+        if (job->cancelled)
+            return;
+        QMetaObject::invokeMethod(this, [this, key, params, job, serial, image]() {
+            finish(key, params, job, serial, image);
+        }, Qt::QueuedConnection);
+    }, priority);
+}
+
+RenderService::JobMap::iterator RenderService::cancel(JobMap::iterator it) {
+    it.value()->cancelled = true;
+    return inFlight.erase(it);
+}
+
+void RenderService::cancelUnwantedPages() {
+    for (auto it = inFlight.begin(); it != inFlight.end();) {
+        const PageKey &key = it.key();
+        PageKey fullKey = key;
+        fullKey.preview = false;
+        auto want = wanted.constFind(key.page);
+        bool stillWanted = want != wanted.constEnd() && *want == fullKey;
+        if (key.tile.isNull() && !stillWanted)
+            it = cancel(it);
+        else
+            ++it;
+    }
+}
+
+void RenderService::cancelUnwantedTiles(const QSet<PageKey> &keep) {
+    for (auto it = inFlight.begin(); it != inFlight.end();) {
+        if (!it.key().tile.isNull() && !keep.contains(it.key()))
+            it = cancel(it);
+        else
+            ++it;
+    }
+}
+
+void RenderService::finish(const PageKey &key, const RenderParams &params, const std::shared_ptr<RenderJob> &job,
+                           int serial, const QImage &image) {
+    if (serial != documentSerial || job->cancelled)
+        return;
+
+    // A newer job for the same key replaced this one after it was cancelled.
+    auto running = inFlight.constFind(key);
+    if (running == inFlight.constEnd() || (*running)->generation != job->generation)
+        return;
+    inFlight.remove(key);
+
+    // Tiles are requested by whoever paints them and are always worth keeping.
+    if (!key.tile.isNull()) {
+        if (!image.isNull()) {
+            cache.insert(key, image);
+            emit tileReady(key.page, key.tile, params);
+        }
+        return;
+    }
+
+    // Drop results nobody is waiting for any more (page turned, window resized).
+    PageKey fullKey = key;
+    fullKey.preview = false;
+    auto want = wanted.constFind(key.page);
+    if (image.isNull() || want == wanted.constEnd() || !(*want == fullKey))
+        return;
+
+    cache.insert(key, image);
+    if (key.preview)
+        emit previewReady(key.page, params, image);
+    else
+        emit pageReady(key.page, params, image);
+}
+
+QImage RenderService::render(const PageKey &key, const RenderParams &params,
+                             const PageRenderer::CancelFlag *cancelled) {
+    QImage image;
+    if (djvuDoc) {
+        DjvuPagePool::Page page = djvuPages.acquire(key.page, cancelled);
+        if (!page)
+            return QImage();
+
+        double scale = PageRenderer::djvuScale(ddjvu_page_get_width(page.get()), ddjvu_page_get_height(page.get()),
+                                               params);
+        if (key.preview)
+            image = PageRenderer::renderDjvu(page.get(), scale / PreviewSubsample, cancelled);
+        else if (key.tile.isNull())
+            image = PageRenderer::renderDjvu(page.get(), scale, cancelled);
+        else
+            image = PageRenderer::renderDjvuTile(page.get(), scale, key.tile, cancelled);
+    } else {
+        std::unique_ptr<Poppler::Document> pdf = acquirePdf();
+        if (!pdf)
+            return QImage();
+
+        if (auto page = pdf->page(key.page)) {
+            // Pool documents keep Poppler's default render hints, i.e. no
+            // antialiasing, which keeps the coarse preview pass cheap.
+            double dpi = PageRenderer::pdfDpi(page->pageSizeF(), params);
+            double previewDpi = dpi / PreviewSubsample;
+            if (key.preview)
+                image = page->renderToImage(previewDpi, previewDpi);
+            else if (key.tile.isNull())
+                image = PageRenderer::renderPdf(page.get(), params, cancelled);
+            else
+                image = PageRenderer::renderPdfTile(page.get(), dpi, key.tile, cancelled);
+        }
+        releasePdf(std::move(pdf));
+    }
+
+    if (params.nightMode && !image.isNull())
+        image = PageRenderer::applyNightMode(std::move(image), params.warmthLevel);
+    return image;
+}
+
+std::unique_ptr<Poppler::Document> RenderService::acquirePdf() {
+    {
+        QMutexLocker locker(&pdfMutex);
+        if (!idlePdfDocs.empty()) {
+            std::unique_ptr<Poppler::Document> pdf = std::move(idlePdfDocs.back());
+            idlePdfDocs.pop_back();
+            return pdf;
+        }
+    }
+
+    std::unique_ptr<Poppler::Document> pdf = Poppler::Document::load(documentPath);
+    if (pdf && pdf->isLocked())
+        pdf.reset();
+    return pdf;
+}
+
+void RenderService::releasePdf(std::unique_ptr<Poppler::Document> pdf) {
+    QMutexLocker locker(&pdfMutex);
+    idlePdfDocs.push_back(std::move(pdf));
+}
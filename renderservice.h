@@ -0,0 +1,139 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QImage>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+
+#include <memory>
+#include <vector>
+
+#include "djvubackend.h"
+#include "djvupagepool.h"
+#include "pagecache.h"
+#include "pagerenderer.h"
+
+// Renders pages on a worker pool and keeps the pages around the current one
+// rasterized ahead of time, so page turns don't block the GUI thread.
+class RenderService : public QObject {
+    Q_OBJECT
+public:
+    explicit RenderService(DjvuBackend *djvu, QObject *parent = nullptr);
+    ~RenderService();
+
+    void setDjvuDocument(ddjvu_document_t *document, const QString &filePath, int pages);
+    // The page sizes, in points, come from the caller's document, so the GUI
+    // thread never loads one of its own.
+    void setPdfDocument(const QString &filePath, const QVector<QSizeF> &sizes);
+    void clearDocument();
+
+    void setThreadCount(int threads);
+    void setPrefetchDistance(int pages);
+    int prefetchDistance() const { return prefetch; }
+
+    void setCacheBudget(qint64 bytes) { cache.setBudget(bytes); }
+    PageCache::Stats cacheStats() const { return cache.stats(); }
+
+    // Decoded DjVu pages kept for re-rendering.
+    void setDecodedPageCount(int pages) { djvuPages.setCapacity(pages); }
+    DjvuPagePool::Stats decodedPageStats() const { return djvuPages.stats(); }
+
+    // Returns the page if it has already been rendered with these parameters.
+    QImage renderedPage(int pageNum, const RenderParams &params);
+
+    // Returns the low-resolution preview of the page, if one has been rendered.
+    QImage previewPage(int pageNum, const RenderParams &params);
+
+    // Size in device pixels renderedPage() will have; previews are scaled up to it for display.
+    QSize pageDisplaySize(int pageNum, const RenderParams &params);
+
+    // Schedules the pages (preview first, then full quality) and their
+    // neighbours within the prefetch distance. Each call supersedes the
+    // previous one: renders it no longer needs are cancelled.
+    void requestPage(int pageNum, const RenderParams &params);
+    void requestPages(const QVector<int> &pages, const RenderParams &params);
+
+    // Tiles are rectangles in pageDisplaySize() coordinates. Visible tiles are
+    // rendered before the ones around them; tiles in neither list are cancelled.
+    // renderedTile() is for painting and doesn't count as a cache lookup;
+    // requestTiles() keeps the requested tiles that are cached from eviction.
+    QImage renderedTile(int pageNum, const QRect &tile, const RenderParams &params);
+    void requestTiles(int pageNum, const QVector<QRect> &visible, const QVector<QRect> &around,
+                      const RenderParams &params);
+
+signals:
+    void pageReady(int pageNum, const RenderParams &params, const QImage &image);
+    void previewReady(int pageNum, const RenderParams &params, const QImage &image);
+    void tileReady(int pageNum, const QRect &tile, const RenderParams &params);
+    // Some DjVu pages turned out to have another size than the placeholder
+    // they were laid out with; sizes that arrive together are reported once.
+    void pageSizesChanged();
+
+private:
+    // Shared between a queued render and the service. The generation is the
+    // request that started it; the flag lets a newer request abandon it.
+    struct RenderJob {
+        quint64 generation = 0;
+        PageRenderer::CancelFlag cancelled{false};
+    };
+    using JobMap = QHash<PageKey, std::shared_ptr<RenderJob>>;
+
+    PageKey cacheKey(int pageNum, const RenderParams &params);
+    PageKey tileKey(int pageNum, const QRect &tile, const RenderParams &params);
+    // Never blocks: a DjVu page whose info isn't available yet gets a
+    // placeholder, and pageSizesChanged() once its info arrives.
+    QSizeF pageSize(int pageNum);
+    void waitForPageSizes();
+    void collectPageSizes();
+
+    void schedule(int pageNum, const RenderParams &params, int priority);
+    void schedulePreview(int pageNum, const RenderParams &params);
+    void start(const PageKey &key, const RenderParams &params, int priority);
+    void finish(const PageKey &key, const RenderParams &params, const std::shared_ptr<RenderJob> &job,
+                int serial, const QImage &image);
+    QImage render(const PageKey &key, const RenderParams &params, const PageRenderer::CancelFlag *cancelled);
+
+    // Cancels in-flight page renders (or tiles) that the latest request no longer wants.
+    void cancelUnwantedPages();
+    void cancelUnwantedTiles(const QSet<PageKey> &keep);
+    JobMap::iterator cancel(JobMap::iterator it);
+
+    std::unique_ptr<Poppler::Document> acquirePdf();
+    void releasePdf(std::unique_ptr<Poppler::Document> pdf);
+
+    DjvuBackend *djvu;
+    ddjvu_document_t *djvuDoc = nullptr;
+    QString documentPath;
+    bool isPdf = false;
+    int pageCount = 0;
+    int prefetch = 2;
+    int documentSerial = 0;
+    quint64 generation = 0;
+
+    // Previews are rendered at this fraction of the final resolution.
+    static constexpr int PreviewSubsample = 4;
+
+    QThreadPool pool;
+    PageCache cache;
+    DjvuPagePool djvuPages;
+
+    // DjVu pages in pixels, filled on first use; PDF pages in points, given
+    // with the document.
+    QVector<QSizeF> pageSizes;
+    QMap<int, QSizeF> pendingPageSizes; // the size each was shown with
+    bool pageSizeWaiting = false;
+    QSizeF placeholderSize; // the first DjVu page size seen; books rarely vary
+
+    JobMap inFlight;
+    QHash<int, PageKey> wanted;
+
+    // Poppler::Document is not safe to use from several threads, so every
+    // thread that reads a PDF loads its own: the thumbnail and text index
+    // threads keep theirs, render workers borrow one from this pool.
+    QMutex pdfMutex;
+    std::vector<std::unique_ptr<Poppler::Document>> idlePdfDocs;
+};
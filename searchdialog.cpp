@@ -15,6 +15,7 @@ SearchDialog::SearchDialog(QWidget *parent)
     connect(nextBtn, &QPushButton::clicked, this, &SearchDialog::searchNext);
     connect(prevBtn, &QPushButton::clicked, this, &SearchDialog::searchPrev);
     connect(edit, &QLineEdit::returnPressed, this, &SearchDialog::searchAll);
+    connect(edit, &QLineEdit::textChanged, this, &SearchDialog::queryChanged);
 }
 
 QString SearchDialog::searchText() const {
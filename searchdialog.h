@@ -17,6 +17,7 @@ signals:
     void searchNext();
     void searchPrev();
     void searchAll();
+    void queryChanged();
 
 private:
     QLineEdit *edit;
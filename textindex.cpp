@@ -0,0 +1,375 @@
+#include "textindex.h"
+#include "djvubackend.h"
+#include "textindexfile.h"
+#include "textlayer.h"
+
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QThreadPool>
+
+extern "C" {
+#include <libdjvu/miniexp.h>
+}
+
+#include <algorithm>
+#include <utility>
+
+TextIndex::TextIndex(QObject *parent)
+    : QObject(parent)
+{
+}
+
+TextIndex::~TextIndex() {
+    stopBuilders();
+}
+
+bool TextIndex::startDocument(int pageCount, const QString &indexPath) {
+    clear();
+    this->indexPath = indexPath;
+    pages.resize(pageCount);
+
+    auto file = std::make_unique<TextIndexFile>();
+    if (!indexPath.isEmpty() && file->open(indexPath) && file->pageCount() == pageCount) {
+        saved = std::move(file);
+        indexed.fill(true, pageCount);
+        indexedPages = pageCount;
+        emit progress(indexedPages, pageCount);
+        return true;
+    }
+
+    indexed.fill(false, pageCount);
+    return false;
+}
+
+void TextIndex::setPdfDocument(const QString &filePath, int pageCount, const QString &indexPath) {
+    if (startDocument(pageCount, indexPath))
+        return;
+
+    // Several builders share one queue, so pages complete roughly in order
+    // and a search over all pages can report results as they arrive.
+    int serial = documentSerial;
+    auto pending = std::make_shared<BuildQueue>(pageCount);
+    queue = pending;
+    int threads = std::max(1, std::min(QThread::idealThreadCount() - 1, pageCount));
+    for (int t = 0; t < threads; ++t) {
+        builders.emplace_back(QThread::create([this, filePath, serial, pending]() {
+            // Each builder loads the file once and reads every page it takes from it.
+            std::unique_ptr<Poppler::Document> doc = Poppler::Document::load(filePath);
+            if (!doc || doc->isLocked())
+                return;
+
+            for (int i = pending->take(); i >= 0; i = pending->take()) {
+                std::unique_ptr<Poppler::Page> page = doc->page(i);
+                deliver(serial, i, page ? extractPdfPage(page.get()) : PageText());
+            }
+        }));
+        builders.back()->start(QThread::LowPriority);
+    }
+}
+
+void TextIndex::setDjvuDocument(DjvuBackend *djvu, const QString &filePath, int pageCount,
+                                const QString &indexPath) {
+    if (startDocument(pageCount, indexPath))
+        return;
+
+    // Hidden text is small next to the page images, so one builder keeps up.
+    // It opens a document of its own so it never competes with the renderer
+    // for the page cache of the viewed one.
+    int serial = documentSerial;
+    auto pending = std::make_shared<BuildQueue>(pageCount);
+    queue = pending;
+    builders.emplace_back(QThread::create([this, djvu, filePath, serial, pending]() {
+        ddjvu_document_t *doc = ddjvu_document_create_by_filename(djvu->context(), filePath.toUtf8().data(), TRUE);
+        if (!doc)
+            return;
+
+        if (djvu->waitForDocument(doc, &pending->stop)) {
+            for (int i = pending->take(); i >= 0; i = pending->take()) {
+                PageText text = extractDjvuPage(*djvu, doc, i, &pending->stop);
+                if (pending->stop)
+                    break;
+                deliver(serial, i, std::move(text));
+            }
+        }
+        ddjvu_document_release(doc);
+    }));
+    builders.back()->start(QThread::LowPriority);
+}
+
+void TextIndex::deliver(int serial, int pageNum, PageText text) {
+    QMetaObject::invokeMethod(this, [this, pageNum, serial, text = std::move(text)]() mutable {
+        if (serial == documentSerial && !hasPage(pageNum))
+            addPage(pageNum, std::move(text));
+    }, Qt::QueuedConnection);
+}
+
+void TextIndex::clear() {
+    stopBuilders();
+    ++documentSerial;
+    pages.clear();
+    indexed.clear();
+    indexedPages = 0;
+    indexPath.clear();
+    saved.reset();
+    lastQuery.clear();
+    lastHits.clear();
+    boxQuery.clear();
+    boxCache.clear();
+    layers.clear();
+}
+
+void TextIndex::stopBuilders() {
+    if (builders.empty())
+        return;
+
+    queue->stop = true;
+    for (auto &builder : builders)
+        builder->wait();
+    builders.clear();
+    queue.reset();
+}
+
+int TextIndex::BuildQueue::take() {
+    QMutexLocker locker(&mutex);
+    while (!stop && !urgent.isEmpty()) {
+        int pageNum = urgent.takeLast();
+        if (!taken[pageNum]) {
+            taken[pageNum] = true;
+            return pageNum;
+        }
+    }
+    while (!stop && next < taken.size()) {
+        int pageNum = next++;
+        if (!taken[pageNum]) {
+            taken[pageNum] = true;
+            return pageNum;
+        }
+    }
+    return -1;
+}
+
+void TextIndex::prioritize(int pageNum) {
+    if (!queue || hasPage(pageNum) || pageNum < 0 || pageNum >= pages.size())
+        return;
+
+    QMutexLocker locker(&queue->mutex);
+    queue->urgent.removeAll(pageNum);
+    queue->urgent.append(pageNum);
+}
+
+bool TextIndex::hasPage(int pageNum) const {
+    return pageNum >= 0 && pageNum < indexed.size() && indexed[pageNum];
+}
+
+void TextIndex::addPage(int pageNum, PageText text) {
+    if (pageNum < 0 || pageNum >= pages.size() || saved)
+        return;
+
+    pages[pageNum] = std::move(text);
+    boxCache.remove(pageNum);
+    for (int i = 0; i < layers.size(); ++i) {
+        if (layers[i].first == pageNum) {
+            layers.removeAt(i);
+            break;
+        }
+    }
+    if (!indexed[pageNum]) {
+        indexed[pageNum] = true;
+        ++indexedPages;
+        emit pageIndexed(pageNum);
+        emit progress(indexedPages, pages.size());
+        if (isComplete())
+            save();
+    }
+}
+
+void TextIndex::save() {
+    if (indexPath.isEmpty())
+        return;
+
+    // Pages are implicitly shared, so the copy for the writer is cheap.
+    QVector<PageText> snapshot = pages;
+    QString path = indexPath;
+    QThreadPool::globalInstance()->start([snapshot, path]() {
+        TextIndexFile::write(path, snapshot);
+    });
+}
+
+QVector<TextIndex::Hit> TextIndex::savedHits(int pageNum, const QString &foldedQuery) const {
+    if (foldedQuery != lastQuery) {
+        lastQuery = foldedQuery;
+        lastHits = saved->find(foldedQuery);
+    }
+
+    auto first = std::lower_bound(lastHits.begin(), lastHits.end(), pageNum,
+                                  [](const Hit &hit, int page) { return hit.page < page; });
+    auto last = first;
+    while (last != lastHits.end() && last->page == pageNum)
+        ++last;
+    return QVector<Hit>(first, last);
+}
+
+bool TextIndex::contains(int pageNum, const QString &foldedQuery) const {
+    if (!hasPage(pageNum) || foldedQuery.isEmpty())
+        return false;
+    if (saved)
+        return !savedHits(pageNum, foldedQuery).isEmpty();
+    return pages[pageNum].folded.contains(foldedQuery);
+}
+
+QVector<QRectF> TextIndex::matchBoxes(int pageNum, const QString &foldedQuery) const {
+    QVector<QRectF> boxes;
+    if (!hasPage(pageNum) || foldedQuery.isEmpty())
+        return boxes;
+
+    if (foldedQuery != boxQuery) {
+        boxQuery = foldedQuery;
+        boxCache.clear();
+    }
+    auto cached = boxCache.constFind(pageNum);
+    if (cached != boxCache.constEnd())
+        return *cached;
+
+    if (saved) {
+        for (const Hit &hit : savedHits(pageNum, foldedQuery)) {
+            for (int w = hit.word; w < hit.word + hit.words; ++w)
+                boxes.append(saved->wordBox(pageNum, w));
+        }
+        boxCache.insert(pageNum, boxes);
+        return boxes;
+    }
+
+    const PageText &page = pages[pageNum];
+    for (int match = page.folded.indexOf(foldedQuery); match >= 0;
+         match = page.folded.indexOf(foldedQuery, match + foldedQuery.size())) {
+        int end = match + foldedQuery.size();
+
+        // Words are in text order: start at the first one ending after the match.
+        auto word = std::upper_bound(page.words.begin(), page.words.end(), match,
+                                     [](int position, const Word &w) { return position < w.start + w.length; });
+        for (; word != page.words.end() && word->start < end; ++word)
+            boxes.append(word->box);
+    }
+    boxCache.insert(pageNum, boxes);
+    return boxes;
+}
+
+std::shared_ptr<const TextLayer> TextIndex::layer(int pageNum) const {
+    if (!hasPage(pageNum))
+        return nullptr;
+
+    for (int i = 0; i < layers.size(); ++i) {
+        if (layers[i].first == pageNum) {
+            auto entry = layers.takeAt(i);
+            layers.append(entry);
+            return entry.second;
+        }
+    }
+
+    auto built = std::make_shared<const TextLayer>(saved ? saved->page(pageNum) : pages[pageNum]);
+    layers.append({pageNum, built});
+    if (layers.size() > LayerCacheSize)
+        layers.removeFirst();
+    return built;
+}
+
+QString TextIndex::snippet(int pageNum, const QString &foldedQuery) const {
+    if (!hasPage(pageNum))
+        return QString();
+
+    if (saved) {
+        QVector<Hit> hits = savedHits(pageNum, foldedQuery);
+        return hits.isEmpty() ? QString() : saved->snippet(pageNum, hits.first().word, foldedQuery.size());
+    }
+
+    const PageText &page = pages[pageNum];
+    int match = std::max<qsizetype>(0, page.folded.indexOf(foldedQuery));
+    return page.text.mid(std::max(0, match - 20), foldedQuery.size() + 40).trimmed();
+}
+
+TextIndex::PageText TextIndex::extractPdfPage(Poppler::Page *page) {
+    PageText result;
+    QSizeF pageSize = page->pageSizeF();
+    if (pageSize.isEmpty())
+        return result;
+
+    std::vector<std::unique_ptr<Poppler::TextBox>> boxes = page->textList();
+    result.words.reserve(static_cast<int>(boxes.size()));
+    for (const auto &box : boxes) {
+        QString word = box->text();
+        if (word.isEmpty())
+            continue;
+
+        QRectF rect = box->boundingBox();
+        result.words.append({QRectF(rect.left() / pageSize.width(), rect.top() / pageSize.height(),
+                                    rect.width() / pageSize.width(), rect.height() / pageSize.height()),
+                             static_cast<int>(result.text.size()), static_cast<int>(word.size())});
+        result.text += word;
+        result.text += ' ';
+    }
+    result.folded = result.text.toCaseFolded();
+    return result;
+}
+
+namespace {
+
+// Zones are (type xmin ymin xmax ymax children...), in page pixels with the
+// origin at the bottom left; the innermost zones hold the text as a string.
+void appendDjvuZone(TextIndex::PageText &page, miniexp_t zone, int width, int height) {
+    if (!miniexp_consp(zone) || !miniexp_symbolp(miniexp_car(zone)))
+        return;
+
+    int coords[4];
+    miniexp_t rest = miniexp_cdr(zone);
+    for (int &coord : coords) {
+        if (!miniexp_numberp(miniexp_car(rest)))
+            return;
+        coord = miniexp_to_int(miniexp_car(rest));
+        rest = miniexp_cdr(rest);
+    }
+
+    for (; miniexp_consp(rest); rest = miniexp_cdr(rest)) {
+        miniexp_t item = miniexp_car(rest);
+        if (!miniexp_stringp(item)) {
+            appendDjvuZone(page, item, width, height);
+            continue;
+        }
+
+        QString word = QString::fromUtf8(miniexp_to_str(item)).trimmed();
+        if (word.isEmpty())
+            continue;
+
+        QRectF box(double(coords[0]) / width, double(height - coords[3]) / height,
+                   double(coords[2] - coords[0]) / width, double(coords[3] - coords[1]) / height);
+        page.words.append({box, static_cast<int>(page.text.size()), static_cast<int>(word.size())});
+        page.text += word;
+        page.text += ' ';
+    }
+}
+
+}
+
+TextIndex::PageText TextIndex::extractDjvuPage(DjvuBackend &djvu, ddjvu_document_t *document, int pageNum,
+                                               const std::atomic<bool> *cancelled) {
+    PageText result;
+
+    ddjvu_pageinfo_t info;
+    if (!djvu.pageInfo(document, pageNum, &info, cancelled) || info.width <= 0 || info.height <= 0)
+        return result;
+
+    // The text is only handed out once it has been decoded; until then each
+    // attempt returns miniexp_dummy.
+    miniexp_t text = miniexp_dummy;
+    auto textStatus = [&]() {
+        text = ddjvu_document_get_pagetext(document, pageNum, "word");
+        return text == miniexp_dummy ? DDJVU_JOB_STARTED : DDJVU_JOB_OK;
+    };
+    if (!djvu.wait(textStatus, cancelled) || text == miniexp_dummy)
+        return result;
+
+    appendDjvuZone(result, text, info.width, info.height);
+    ddjvu_miniexp_release(document, text);
+
+    result.folded = result.text.toCaseFolded();
+    return result;
+}
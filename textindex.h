@@ -0,0 +1,148 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QRectF>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libdjvu/ddjvuapi.h>
+}
+
+#include <poppler-qt6.h>
+
+class TextIndexFile;
+class DjvuBackend;
+class TextLayer;
+
+// The searchable text of the open document: the PDF text layer or the DjVu
+// hidden text. Pages are extracted once, on background threads after the
+// document opens, and kept case-folded together
+// with their word boxes, so searches and highlights are lookups rather than
+// a fresh text extraction per page. Pages the builders haven't reached yet
+// can be moved to the front with prioritize(); pageIndexed() reports each
+// page as it arrives. Nothing is ever extracted on the GUI thread.
+//
+// Once every page is indexed the index is saved to the document's cache
+// directory (see TextIndexFile), and later sessions map that file instead
+// of extracting anything.
+//
+// Owned and queried on the GUI thread; the builder hands pages over through
+// queued calls.
+class TextIndex : public QObject {
+    Q_OBJECT
+public:
+    struct Word {
+        QRectF box;     // page coordinates normalized to 0..1
+        int start = 0;  // position in the page text
+        int length = 0;
+    };
+
+    struct PageText {
+        QString text;   // words separated by single spaces
+        QString folded; // text.toCaseFolded(), position for position
+        QVector<Word> words;
+    };
+
+    // A match of a query: words [word, word + words) of the page.
+    struct Hit {
+        int page = 0;
+        int word = 0;
+        int words = 0;
+    };
+
+    explicit TextIndex(QObject *parent = nullptr);
+    ~TextIndex();
+
+    // Uses the index saved at indexPath if there is one for this document,
+    // otherwise starts indexing it in the background and saves the result
+    // there. Replaces any previous document.
+    void setPdfDocument(const QString &filePath, int pageCount, const QString &indexPath);
+    void setDjvuDocument(DjvuBackend *djvu, const QString &filePath, int pageCount, const QString &indexPath);
+    void clear();
+
+    int pageCount() const { return pages.size(); }
+    bool isComplete() const { return indexedPages == pages.size(); }
+    bool hasPage(int pageNum) const;
+
+    // Has a builder extract the page next, if it hasn't been yet.
+    void prioritize(int pageNum);
+
+    // Queries are matched case-insensitively and with runs of whitespace
+    // collapsed; fold them once with fold(). Pages that aren't indexed yet
+    // never match.
+    static QString fold(const QString &text) { return text.toCaseFolded().simplified(); }
+    bool contains(int pageNum, const QString &foldedQuery) const;
+    QVector<QRectF> matchBoxes(int pageNum, const QString &foldedQuery) const;
+    QString snippet(int pageNum, const QString &foldedQuery) const;
+
+    // The page's words for hit tests and selection; null if the page isn't
+    // indexed yet.
+    std::shared_ptr<const TextLayer> layer(int pageNum) const;
+
+signals:
+    void progress(int indexedPages, int totalPages);
+    void pageIndexed(int pageNum);
+
+private:
+    // Hands out pages to the builders: prioritized ones first, most recent
+    // request first, then the rest in order. Each page is handed out once.
+    struct BuildQueue {
+        std::atomic<bool> stop{false};
+        QMutex mutex;
+        QVector<bool> taken;
+        QVector<int> urgent;
+        int next = 0;
+
+        explicit BuildQueue(int pageCount) : taken(pageCount, false) {}
+        int take(); // -1 once every page has been handed out or on stop
+    };
+
+    static PageText extractPdfPage(Poppler::Page *page);
+
+    // Waits for the page's text; empty if it failed or cancelled was set first.
+    static PageText extractDjvuPage(DjvuBackend &djvu, ddjvu_document_t *document, int pageNum,
+                                    const std::atomic<bool> *cancelled = nullptr);
+
+    // Clears the index for a new document; true if it was loaded from a
+    // saved index and needs no builders.
+    bool startDocument(int pageCount, const QString &indexPath);
+    void stopBuilders();
+    void deliver(int serial, int pageNum, PageText text);
+    void addPage(int pageNum, PageText text);
+    void save();
+
+    // Saved index lookups, for the last query only.
+    QVector<Hit> savedHits(int pageNum, const QString &foldedQuery) const;
+
+    QVector<PageText> pages;
+    QVector<bool> indexed;
+    int indexedPages = 0;
+
+    // Results from builders that belong to a previous document are dropped.
+    int documentSerial = 0;
+    std::vector<std::unique_ptr<QThread>> builders;
+    std::shared_ptr<BuildQueue> queue;
+
+    QString indexPath;
+    std::unique_ptr<TextIndexFile> saved;
+    mutable QString lastQuery;
+    mutable QVector<Hit> lastHits;
+
+    // Highlight boxes per page for the last highlighted query, so a page
+    // turn doesn't search the page again.
+    mutable QString boxQuery;
+    mutable QHash<int, QVector<QRectF>> boxCache;
+
+    // Text layers of the most recently used pages, oldest first.
+    static constexpr int LayerCacheSize = 16;
+    mutable QVector<QPair<int, std::shared_ptr<const TextLayer>>> layers;
+};
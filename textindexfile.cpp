@@ -0,0 +1,364 @@
+#include "textindexfile.h"
+
+#include <QHash>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// All fields are native-endian; a file written on a machine of the other
+// endianness fails the version check and is rebuilt.
+struct TextIndexFile::Header {
+    char magic[4];
+    quint32 version;
+    quint32 pageCount;
+    quint32 wordCount;
+    quint32 termCount;
+    quint32 postingCount;
+    quint32 termTextLength; // UTF-16 units
+    quint32 pageTextLength;
+    quint32 pagesOffset;    // pageCount + 1 entries, the last one closing the final page
+    quint32 wordsOffset;
+    quint32 termsOffset;    // sorted by term text
+    quint32 postingsOffset; // grouped by term, in page and word order
+    quint32 termTextOffset;
+    quint32 pageTextOffset;
+};
+
+struct TextIndexFile::PageEntry {
+    quint32 firstWord;
+    quint32 textStart;
+};
+
+struct TextIndexFile::WordEntry {
+    quint16 x, y, width, height; // normalized to 0..65535
+    quint32 term;
+    quint32 textStart;           // relative to the page's text
+};
+
+struct TextIndexFile::TermEntry {
+    quint32 textStart;
+    quint32 length;
+    quint32 firstPosting;
+    quint32 postingCount;
+};
+
+struct TextIndexFile::Posting {
+    quint32 page;
+    quint32 word; // position among the page's words
+};
+
+namespace {
+
+const char Magic[4] = {'B', 'R', 'T', 'I'};
+constexpr quint32 Version = 1;
+
+quint16 quantize(double value) {
+    return static_cast<quint16>(std::lround(std::clamp(value, 0.0, 1.0) * 65535.0));
+}
+
+template <typename T>
+bool writeArray(QSaveFile &file, const T *items, qsizetype count) {
+    qint64 bytes = static_cast<qint64>(count) * sizeof(T);
+    return file.write(reinterpret_cast<const char *>(items), bytes) == bytes;
+}
+
+}
+
+bool TextIndexFile::write(const QString &path, const QVector<TextIndex::PageText> &pages) {
+    QVector<PageEntry> pageEntries;
+    QVector<WordEntry> words;
+    QHash<QString, quint32> termIds;
+    QVector<QString> terms;
+    QVector<QVector<Posting>> termPostings;
+    QString pageText;
+
+    for (int p = 0; p < pages.size(); ++p) {
+        const TextIndex::PageText &page = pages[p];
+        pageEntries.append({static_cast<quint32>(words.size()), static_cast<quint32>(pageText.size())});
+        pageText += page.text;
+
+        for (int w = 0; w < page.words.size(); ++w) {
+            const TextIndex::Word &word = page.words[w];
+            QString term = page.folded.mid(word.start, word.length);
+            auto it = termIds.constFind(term);
+            if (it == termIds.constEnd()) {
+                it = termIds.insert(term, static_cast<quint32>(terms.size()));
+                terms.append(term);
+                termPostings.append(QVector<Posting>());
+            }
+            termPostings[*it].append({static_cast<quint32>(p), static_cast<quint32>(w)});
+            words.append({quantize(word.box.x()), quantize(word.box.y()),
+                          quantize(word.box.width()), quantize(word.box.height()),
+                          *it, static_cast<quint32>(word.start)});
+        }
+    }
+    pageEntries.append({static_cast<quint32>(words.size()), static_cast<quint32>(pageText.size())});
+
+    // Sort the dictionary and renumber the words' terms to match.
+    QVector<quint32> order(terms.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&terms](quint32 a, quint32 b) {
+        return QStringView(terms[a]) < QStringView(terms[b]);
+    });
+    QVector<quint32> rank(terms.size());
+    for (int i = 0; i < order.size(); ++i)
+        rank[order[i]] = i;
+    for (WordEntry &word : words)
+        word.term = rank[word.term];
+
+    QVector<TermEntry> termEntries;
+    QVector<Posting> postings;
+    QString termText;
+    for (quint32 id : order) {
+        termEntries.append({static_cast<quint32>(termText.size()), static_cast<quint32>(terms[id].size()),
+                            static_cast<quint32>(postings.size()), static_cast<quint32>(termPostings[id].size())});
+        termText += terms[id];
+        postings += termPostings[id];
+    }
+
+    Header header;
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.pageCount = pages.size();
+    header.wordCount = words.size();
+    header.termCount = termEntries.size();
+    header.postingCount = postings.size();
+    header.termTextLength = termText.size();
+    header.pageTextLength = pageText.size();
+    header.pagesOffset = sizeof(Header);
+    header.wordsOffset = header.pagesOffset + pageEntries.size() * sizeof(PageEntry);
+    header.termsOffset = header.wordsOffset + words.size() * sizeof(WordEntry);
+    header.postingsOffset = header.termsOffset + termEntries.size() * sizeof(TermEntry);
+    header.termTextOffset = header.postingsOffset + postings.size() * sizeof(Posting);
+    header.pageTextOffset = header.termTextOffset + termText.size() * sizeof(QChar);
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    bool ok = writeArray(file, &header, 1)
+              && writeArray(file, pageEntries.constData(), pageEntries.size())
+              && writeArray(file, words.constData(), words.size())
+              && writeArray(file, termEntries.constData(), termEntries.size())
+              && writeArray(file, postings.constData(), postings.size())
+              && writeArray(file, termText.constData(), termText.size())
+              && writeArray(file, pageText.constData(), pageText.size());
+    if (!ok) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool TextIndexFile::open(const QString &path) {
+    auto mapped = std::make_unique<QFile>(path);
+    if (!mapped->open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 fileSize = mapped->size();
+    if (fileSize < static_cast<qint64>(sizeof(Header)))
+        return false;
+
+    const uchar *bytes = mapped->map(0, fileSize);
+    if (!bytes)
+        return false;
+
+    const Header *h = reinterpret_cast<const Header *>(bytes);
+    auto fits = [fileSize](quint64 offset, quint64 count, quint64 itemSize) {
+        return offset % 4 == 0 && offset + count * itemSize <= static_cast<quint64>(fileSize);
+    };
+    if (std::memcmp(h->magic, Magic, sizeof(Magic)) != 0 || h->version != Version
+        || !fits(h->pagesOffset, h->pageCount + 1ull, sizeof(PageEntry))
+        || !fits(h->wordsOffset, h->wordCount, sizeof(WordEntry))
+        || !fits(h->termsOffset, h->termCount, sizeof(TermEntry))
+        || !fits(h->postingsOffset, h->postingCount, sizeof(Posting))
+        || h->termTextOffset + h->termTextLength * 2ull > static_cast<quint64>(fileSize)
+        || h->pageTextOffset + h->pageTextLength * 2ull > static_cast<quint64>(fileSize))
+        return false;
+
+    file = std::move(mapped);
+    data = bytes;
+    size = fileSize;
+    return true;
+}
+
+const TextIndexFile::Header *TextIndexFile::header() const {
+    return reinterpret_cast<const Header *>(data);
+}
+
+template <typename T>
+const T *TextIndexFile::section(quint32 offset) const {
+    return reinterpret_cast<const T *>(data + offset);
+}
+
+int TextIndexFile::pageCount() const {
+    return isOpen() ? static_cast<int>(header()->pageCount) : 0;
+}
+
+QStringView TextIndexFile::term(int index) const {
+    const Header *h = header();
+    const TermEntry &entry = section<TermEntry>(h->termsOffset)[index];
+    if (static_cast<quint64>(entry.textStart) + entry.length > h->termTextLength)
+        return QStringView();
+    return QStringView(section<QChar>(h->termTextOffset) + entry.textStart, entry.length);
+}
+
+QStringView TextIndexFile::pageText(int pageNum) const {
+    const Header *h = header();
+    const PageEntry *pages = section<PageEntry>(h->pagesOffset);
+    quint32 start = pages[pageNum].textStart;
+    quint32 end = pages[pageNum + 1].textStart;
+    if (start > end || end > h->pageTextLength)
+        return QStringView();
+    return QStringView(section<QChar>(h->pageTextOffset) + start, end - start);
+}
+
+int TextIndexFile::wordCount(int pageNum) const {
+    if (pageNum < 0 || pageNum >= pageCount())
+        return 0;
+
+    const PageEntry *pages = section<PageEntry>(header()->pagesOffset);
+    quint32 first = pages[pageNum].firstWord;
+    quint32 end = std::min(pages[pageNum + 1].firstWord, header()->wordCount);
+    return end > first ? static_cast<int>(end - first) : 0;
+}
+
+QRectF TextIndexFile::wordBox(int pageNum, int word) const {
+    if (word < 0 || word >= wordCount(pageNum))
+        return QRectF();
+
+    const Header *h = header();
+    const WordEntry &entry = section<WordEntry>(h->wordsOffset)[section<PageEntry>(h->pagesOffset)[pageNum].firstWord + word];
+    return QRectF(entry.x / 65535.0, entry.y / 65535.0, entry.width / 65535.0, entry.height / 65535.0);
+}
+
+QString TextIndexFile::snippet(int pageNum, int word, int length) const {
+    if (word < 0 || word >= wordCount(pageNum))
+        return QString();
+
+    const Header *h = header();
+    const WordEntry &entry = section<WordEntry>(h->wordsOffset)[section<PageEntry>(h->pagesOffset)[pageNum].firstWord + word];
+    QStringView text = pageText(pageNum);
+    qsizetype start = std::min<qsizetype>(entry.textStart, text.size());
+    return text.mid(std::max<qsizetype>(0, start - 20), length + 40).toString().trimmed();
+}
+
+TextIndex::PageText TextIndexFile::page(int pageNum) const {
+    TextIndex::PageText result;
+    int count = wordCount(pageNum);
+    if (count == 0)
+        return result;
+
+    result.text = pageText(pageNum).toString();
+    result.folded = result.text.toCaseFolded();
+
+    // Words are separated by single spaces, so each one ends where the next begins.
+    const Header *h = header();
+    const WordEntry *words = section<WordEntry>(h->wordsOffset) + section<PageEntry>(h->pagesOffset)[pageNum].firstWord;
+    result.words.reserve(count);
+    for (int w = 0; w < count; ++w) {
+        int start = std::min<int>(words[w].textStart, result.text.size());
+        int end = w + 1 < count ? std::min<int>(words[w + 1].textStart, result.text.size()) : result.text.size();
+        result.words.append({wordBox(pageNum, w), start, std::max(0, end - start - 1)});
+    }
+    return result;
+}
+
+QVector<TextIndex::Hit> TextIndexFile::find(const QString &foldedQuery) const {
+    QVector<TextIndex::Hit> hits;
+    if (!isOpen() || foldedQuery.isEmpty())
+        return hits;
+
+    const QList<QStringView> parts = QStringView(foldedQuery).split(QLatin1Char(' '));
+    const int count = parts.size();
+    const Header *h = header();
+    const PageEntry *pages = section<PageEntry>(h->pagesOffset);
+    const WordEntry *words = section<WordEntry>(h->wordsOffset);
+    const TermEntry *terms = section<TermEntry>(h->termsOffset);
+    const Posting *postings = section<Posting>(h->postingsOffset);
+
+    const TermEntry *termsEnd = terms + h->termCount;
+    auto termOf = [&](const TermEntry &entry) { return term(static_cast<int>(&entry - terms)); };
+
+    // Calls visit for every posting of the term that lies within the index.
+    auto forPostings = [&](const TermEntry &entry, auto &&visit) {
+        if (static_cast<quint64>(entry.firstPosting) + entry.postingCount > h->postingCount)
+            return;
+        for (quint32 p = entry.firstPosting; p < entry.firstPosting + entry.postingCount; ++p) {
+            if (postings[p].page < h->pageCount)
+                visit(postings[p]);
+        }
+    };
+
+    // Whether the phrase starts at the page's word.
+    auto phraseAt = [&](quint32 page, quint32 first) {
+        if (static_cast<quint64>(first) + count > static_cast<quint64>(wordCount(page)))
+            return false;
+        const WordEntry *next = words + pages[page].firstWord + first;
+        for (int k = 0; k < count; ++k) {
+            if (next[k].term >= h->termCount)
+                return false;
+            QStringView text = term(next[k].term);
+            bool matches = k == 0 ? text.endsWith(parts[k])
+                           : k < count - 1 ? text == parts[k] : text.startsWith(parts[k]);
+            if (!matches)
+                return false;
+        }
+        return true;
+    };
+
+    // A phrase is found through the postings of its k-th word, looked up in
+    // the sorted dictionary, and checked from where it would start.
+    auto addPhrasesThrough = [&](const TermEntry &entry, int k) {
+        forPostings(entry, [&](const Posting &posting) {
+            if (posting.word >= static_cast<quint32>(k) && phraseAt(posting.page, posting.word - k))
+                hits.append({static_cast<int>(posting.page), static_cast<int>(posting.word) - k, count});
+        });
+    };
+    auto lowerBound = [&](QStringView text) {
+        return std::lower_bound(terms, termsEnd, text, [&](const TermEntry &entry, QStringView value) {
+            return termOf(entry) < value;
+        });
+    };
+
+    if (count == 1) {
+        // A single term matches inside words, which the sort order can't find.
+        for (const TermEntry *entry = terms; entry != termsEnd; ++entry) {
+            if (termOf(*entry).contains(parts[0])) {
+                forPostings(*entry, [&](const Posting &posting) {
+                    hits.append({static_cast<int>(posting.page), static_cast<int>(posting.word), 1});
+                });
+            }
+        }
+    } else if (count == 2) {
+        // Every term starting with the last word is one contiguous run.
+        const TermEntry *first = lowerBound(parts[1]);
+        const TermEntry *last = std::partition_point(first, termsEnd, [&](const TermEntry &entry) {
+            return termOf(entry).startsWith(parts[1]);
+        });
+        for (const TermEntry *entry = first; entry != last; ++entry)
+            addPhrasesThrough(*entry, 1);
+    } else {
+        // Middle words match whole terms; the rarest of them leads.
+        const TermEntry *rarest = nullptr;
+        int rarestWord = 0;
+        for (int k = 1; k < count - 1; ++k) {
+            const TermEntry *entry = lowerBound(parts[k]);
+            if (entry == termsEnd || termOf(*entry) != parts[k])
+                return hits;
+            if (!rarest || entry->postingCount < rarest->postingCount) {
+                rarest = entry;
+                rarestWord = k;
+            }
+        }
+        addPhrasesThrough(*rarest, rarestWord);
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const TextIndex::Hit &a, const TextIndex::Hit &b) {
+        return a.page != b.page ? a.page < b.page : a.word < b.word;
+    });
+    return hits;
+}
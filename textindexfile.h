@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QFile>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+#include <memory>
+
+#include "textindex.h"
+
+// The text index in a form that is used straight from a memory mapping:
+// a sorted term dictionary with (page, word) postings, and per page its
+// text and word boxes. Opening it costs an mmap. A phrase search costs a
+// binary search of the dictionary plus a walk over one term's postings; a
+// single term, which may match inside words, scans the dictionary.
+//
+// Terms are case-folded words. A query matches the same places as a
+// substring search over the page text: a single term may match inside a
+// word, and in a phrase the first term matches word endings, the middle
+// terms whole words and the last term word beginnings.
+class TextIndexFile {
+public:
+    TextIndexFile() = default;
+
+    // Writes through a temporary file, so a reader never sees a partial index.
+    static bool write(const QString &path, const QVector<TextIndex::PageText> &pages);
+
+    // Maps the file; false if it is missing, truncated or from another version.
+    bool open(const QString &path);
+    bool isOpen() const { return data != nullptr; }
+    int pageCount() const;
+
+    // Matches in page order; the query must be folded with TextIndex::fold().
+    QVector<TextIndex::Hit> find(const QString &foldedQuery) const;
+
+    int wordCount(int pageNum) const;
+    QRectF wordBox(int pageNum, int word) const;
+    QString snippet(int pageNum, int word, int length) const;
+
+    // The page's text and words as they were indexed.
+    TextIndex::PageText page(int pageNum) const;
+
+private:
+    struct Header;
+    struct PageEntry;
+    struct WordEntry;
+    struct TermEntry;
+    struct Posting;
+
+    const Header *header() const;
+    template <typename T> const T *section(quint32 offset) const;
+    QStringView term(int index) const;
+    QStringView pageText(int pageNum) const;
+
+    std::unique_ptr<QFile> file;
+    const uchar *data = nullptr;
+    qint64 size = 0;
+};
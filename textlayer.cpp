@@ -0,0 +1,70 @@
+#include "textlayer.h"
+
+#include <algorithm>
+
+TextLayer::TextLayer(const TextIndex::PageText &page)
+    : page(page), cells(GridSize * GridSize)
+{
+    for (int w = 0; w < page.words.size(); ++w) {
+        QRect span = cellsFor(page.words[w].box);
+        for (int y = span.top(); y <= span.bottom(); ++y) {
+            for (int x = span.left(); x <= span.right(); ++x)
+                cells[y * GridSize + x].append(w);
+        }
+    }
+}
+
+QRect TextLayer::cellsFor(const QRectF &rect) const {
+    auto cell = [](double value) {
+        return std::clamp(static_cast<int>(value * GridSize), 0, GridSize - 1);
+    };
+    return QRect(QPoint(cell(rect.left()), cell(rect.top())), QPoint(cell(rect.right()), cell(rect.bottom())));
+}
+
+QVector<int> TextLayer::wordsIn(const QRectF &rect) const {
+    QVector<int> result;
+    QRectF area = rect.normalized();
+    if (page.words.isEmpty() || area.isEmpty())
+        return result;
+
+    QRect span = cellsFor(area);
+    for (int y = span.top(); y <= span.bottom(); ++y) {
+        for (int x = span.left(); x <= span.right(); ++x) {
+            for (int w : cells[y * GridSize + x]) {
+                if (page.words[w].box.intersects(area))
+                    result.append(w);
+            }
+        }
+    }
+
+    // A word spanning several cells is found once per cell.
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+QVector<QRectF> TextLayer::boxes(const QVector<int> &words) const {
+    QVector<QRectF> result;
+    result.reserve(words.size());
+    for (int w : words) {
+        if (w >= 0 && w < page.words.size())
+            result.append(page.words[w].box);
+    }
+    return result;
+}
+
+QString TextLayer::text(const QVector<int> &words) const {
+    QString result;
+    const TextIndex::Word *previous = nullptr;
+    for (int w : words) {
+        if (w < 0 || w >= page.words.size())
+            continue;
+
+        const TextIndex::Word &word = page.words[w];
+        if (previous)
+            result += word.box.top() >= previous->box.bottom() ? '\n' : ' ';
+        result += page.text.mid(word.start, word.length);
+        previous = &word;
+    }
+    return result;
+}
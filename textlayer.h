@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+#include "textindex.h"
+
+// One page's words bucketed into a fixed grid over the page, so finding the
+// words under a rectangle only looks at the cells it covers instead of every
+// word on the page. Built once per page and shared by highlighting and
+// rubber-band selection.
+class TextLayer {
+public:
+    static constexpr int GridSize = 16; // cells per side
+
+    explicit TextLayer(const TextIndex::PageText &page);
+
+    // Words whose boxes intersect rect (normalized page coordinates), in
+    // text order.
+    QVector<int> wordsIn(const QRectF &rect) const;
+
+    QVector<QRectF> boxes(const QVector<int> &words) const;
+
+    // The words' text; words on a new line start a new line of text.
+    QString text(const QVector<int> &words) const;
+
+private:
+    QRect cellsFor(const QRectF &rect) const;
+
+    TextIndex::PageText page;
+    QVector<QVector<int>> cells; // row-major, word indices in text order
+};
@@ -0,0 +1,162 @@
+#include "thumbnaildiskcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Bytes hashed from each end of the file for the fingerprint.
+constexpr qint64 FingerprintBytes = 64 * 1024;
+
+// Touched whenever a document is opened; its modification time orders eviction.
+const char *const StampFile = "last-used";
+
+QString thumbnailPath(const QString &directory, int page) {
+    return QString("%1/%2.jpg").arg(directory).arg(page);
+}
+
+qint64 directorySize(const QString &path) {
+    qint64 total = 0;
+    QDirIterator it(path, QDir::Files | QDir::Hidden);
+    while (it.hasNext()) {
+        it.next();
+        total += it.fileInfo().size();
+    }
+    return total;
+}
+
+}
+
+ThumbnailDiskCache::ThumbnailDiskCache(qint64 budgetBytes)
+    : root(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails"),
+      maxBytes(budgetBytes)
+{
+}
+
+void ThumbnailDiskCache::setBudget(qint64 bytes) {
+    maxBytes = std::max<qint64>(0, bytes);
+    QString cacheRoot = root;
+    QString keep = currentKey;
+    qint64 budget = maxBytes;
+    QThreadPool::globalInstance()->start([cacheRoot, keep, budget]() {
+        trim(cacheRoot, keep, budget);
+    });
+}
+
+QString ThumbnailDiskCache::documentDirectory(const QString &filePath) {
+    QString key = fingerprint(filePath);
+    if (key.isEmpty())
+        return QString();
+
+    QString directory = root + "/" + key;
+    if (!QDir().mkpath(directory))
+        return QString();
+
+    currentKey = key;
+    QFile stamp(directory + "/" + StampFile);
+    if (stamp.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        stamp.write(QFileInfo(filePath).fileName().toUtf8());
+
+    QString cacheRoot = root;
+    qint64 budget = maxBytes;
+    QThreadPool::globalInstance()->start([cacheRoot, key, budget]() {
+        trim(cacheRoot, key, budget);
+    });
+    return directory;
+}
+
+qint64 ThumbnailDiskCache::diskUsage() const {
+    qint64 total = 0;
+    const QStringList documents = QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &name : documents)
+        total += directorySize(root + "/" + name);
+    return total;
+}
+
+void ThumbnailDiskCache::clear() {
+    trim(root, currentKey, 0);
+}
+
+QString ThumbnailDiskCache::fingerprint(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    QFileInfo info(file);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    hash.addData(file.read(FingerprintBytes));
+    if (info.size() > FingerprintBytes) {
+        file.seek(std::max(FingerprintBytes, info.size() - FingerprintBytes));
+        hash.addData(file.read(FingerprintBytes));
+    }
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QImage ThumbnailDiskCache::load(const QString &directory, int page) {
+    if (directory.isEmpty())
+        return QImage();
+
+    QString path = thumbnailPath(directory, page);
+    if (!QFile::exists(path))
+        return QImage();
+
+    QImage image(path);
+    if (image.isNull())
+        QFile::remove(path);
+    return image;
+}
+
+void ThumbnailDiskCache::store(const QString &directory, int page, const QImage &image) {
+    if (directory.isEmpty() || image.isNull())
+        return;
+
+    // QSaveFile writes to a temporary and renames it over the target on commit.
+    QSaveFile file(thumbnailPath(directory, page));
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    if (image.save(&file, "JPG", 85))
+        file.commit();
+    else
+        file.cancelWriting();
+}
+
+void ThumbnailDiskCache::trim(const QString &root, const QString &keep, qint64 budget) {
+    struct Document {
+        QString path;
+        QDateTime lastUsed;
+        qint64 bytes;
+    };
+
+    std::vector<Document> documents;
+    qint64 total = 0;
+    const QStringList names = QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &name : names) {
+        QString path = root + "/" + name;
+        qint64 bytes = directorySize(path);
+        total += bytes;
+        if (name != keep)
+            documents.push_back({path, QFileInfo(path + "/" + StampFile).lastModified(), bytes});
+    }
+
+    std::sort(documents.begin(), documents.end(), [](const Document &a, const Document &b) {
+        return a.lastUsed < b.lastUsed;
+    });
+    for (const Document &document : documents) {
+        if (total <= budget)
+            break;
+        if (QDir(document.path).removeRecursively())
+            total -= document.bytes;
+    }
+}
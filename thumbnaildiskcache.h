@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+// Encoded thumbnails kept on disk between sessions, one directory per
+// document under the user's cache location. Documents are identified by a
+// fingerprint of their size, modification time and first and last bytes, so
+// a renamed copy still hits and an edited file misses.
+//
+// The cache is bounded by total size; whole documents are evicted, least
+// recently opened first. Writes go through a temporary file that is renamed
+// into place, and files that fail to decode are discarded, so an interrupted
+// write never shows up as a broken thumbnail.
+class ThumbnailDiskCache {
+public:
+    explicit ThumbnailDiskCache(qint64 budgetBytes = 256ll * 1024 * 1024);
+
+    // Trimming never touches the most recently opened document, whose text
+    // index may still be mapped and written.
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return maxBytes; }
+
+    // Returns the directory holding the document's thumbnails (empty if it
+    // can't be created) and marks it as most recently used. Other documents
+    // are trimmed to the budget on a background thread.
+    QString documentDirectory(const QString &filePath);
+
+    // Bytes used by all cached documents.
+    qint64 diskUsage() const;
+    // Removes every document but the open one.
+    void clear();
+
+    static QString fingerprint(const QString &filePath);
+
+    // Safe to call from any thread.
+    static QImage load(const QString &directory, int page);
+    static void store(const QString &directory, int page, const QImage &image);
+
+private:
+    static void trim(const QString &root, const QString &keep, qint64 budget);
+
+    QString root;
+    QString currentKey;
+    qint64 maxBytes;
+};
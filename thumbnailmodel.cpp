@@ -0,0 +1,94 @@
+#include "thumbnailmodel.h"
+
+#include "pagerenderer.h"
+
+ThumbnailModel::ThumbnailModel(qint64 budgetBytes, QObject *parent)
+    : QAbstractListModel(parent), cache(budgetBytes),
+      placeholder(ThumbnailSize, QImage::Format_RGB32)
+{
+    placeholder.fill(QColor(0x3a, 0x3a, 0x3a));
+}
+
+void ThumbnailModel::setPageCount(int pages) {
+    beginResetModel();
+    pageCount = pages;
+    cache.clear();
+    sources.fill(0, pages);
+    stats = Stats();
+    endResetModel();
+}
+
+void ThumbnailModel::setNightMode(bool enabled, int warmth) {
+    if (enabled == nightMode && warmth == warmthLevel)
+        return;
+
+    nightMode = enabled;
+    warmthLevel = warmth;
+    if (pageCount > 0)
+        emit dataChanged(index(0), index(pageCount - 1), {Qt::DecorationRole});
+}
+
+void ThumbnailModel::setThumbnail(int page, const QImage &image, Source source, qint64 elapsedNanoseconds) {
+    if (page < 0 || page >= pageCount || image.isNull())
+        return;
+
+    sources[page] = static_cast<quint8>(source + 1);
+    stats.pages[source]++;
+    stats.nanoseconds[source] += elapsedNanoseconds;
+
+    QImage thumbnail = image;
+    if (image.width() > ThumbnailSize.width() || image.height() > ThumbnailSize.height())
+        thumbnail = image.scaled(ThumbnailSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    cache.insert(cacheKey(page, false), thumbnail);
+    QModelIndex row = index(page);
+    emit dataChanged(row, row, {Qt::DecorationRole});
+}
+
+QVector<int> ThumbnailModel::missing(const QVector<int> &rows) const {
+    QVector<int> result;
+    for (int row : rows) {
+        if (row >= 0 && row < pageCount && !cache.contains(cacheKey(row, false)))
+            result.append(row);
+    }
+    return result;
+}
+
+int ThumbnailModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : pageCount;
+}
+
+QVariant ThumbnailModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= pageCount)
+        return QVariant();
+
+    if (role == Qt::SizeHintRole)
+        return ThumbnailSize;
+    if (role == Qt::ToolTipRole) {
+        static const char *const sourceNames[SourceCount] = {"from disk cache", "embedded thumbnail", "rendered"};
+        int source = sources[index.row()] - 1;
+        if (source < 0)
+            return QString("Page %1").arg(index.row() + 1);
+        return QString("Page %1 (%2)").arg(index.row() + 1).arg(sourceNames[source]);
+    }
+    if (role != Qt::DecorationRole)
+        return QVariant();
+
+    QImage image = cache.find(cacheKey(index.row(), nightMode));
+    if (image.isNull() && nightMode) {
+        QImage original = cache.peek(cacheKey(index.row(), false));
+        if (!original.isNull()) {
+            image = PageRenderer::applyNightMode(original, warmthLevel);
+            cache.insert(cacheKey(index.row(), true), image);
+        }
+    }
+    return image.isNull() ? placeholder : image;
+}
+
+PageKey ThumbnailModel::cacheKey(int page, bool night) const {
+    PageKey key;
+    key.page = page;
+    key.nightMode = night;
+    key.warmthLevel = night ? warmthLevel : 0;
+    return key;
+}
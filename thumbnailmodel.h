@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QImage>
+#include <QSize>
+#include <QVector>
+
+#include "pagecache.h"
+
+// One row per page. Thumbnails live in a size-bounded LRU cache rather than
+// per row, so a 10,000 page document only holds the thumbnails that were
+// looked at recently; every other row shows a placeholder until the view
+// asks for it again.
+class ThumbnailModel : public QAbstractListModel {
+    Q_OBJECT
+public:
+    // Thumbnails are scaled to fit this box.
+    static constexpr QSize ThumbnailSize{80, 100};
+
+    // Where a page's thumbnail came from, cheapest first.
+    enum Source { DiskCache, Embedded, Rendered, SourceCount };
+
+    struct Stats {
+        int pages[SourceCount] = {};
+        qint64 nanoseconds[SourceCount] = {};
+    };
+
+    explicit ThumbnailModel(qint64 budgetBytes = 16ll * 1024 * 1024, QObject *parent = nullptr);
+
+    // Starts over for a newly opened document.
+    void setPageCount(int pages);
+    void setNightMode(bool enabled, int warmthLevel);
+    // elapsedNanoseconds is how long the source took to produce the image.
+    void setThumbnail(int page, const QImage &image, Source source, qint64 elapsedNanoseconds);
+
+    // The rows that have no thumbnail cached yet, in the order given.
+    QVector<int> missing(const QVector<int> &rows) const;
+
+    PageCache::Stats cacheStats() const { return cache.stats(); }
+    Stats sourceStats() const { return stats; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    PageKey cacheKey(int page, bool night) const;
+
+    int pageCount = 0;
+    bool nightMode = false;
+    int warmthLevel = 20;
+
+    // Holds the rendered thumbnails and, in night mode, their converted
+    // copies, so toggling night mode doesn't need a re-render.
+    mutable PageCache cache;
+    QImage placeholder;
+
+    // Per page: 0 until a thumbnail arrives, then its Source + 1.
+    QVector<quint8> sources;
+    Stats stats;
+};
@@ -0,0 +1,142 @@
+#include "thumbnailworker.h"
+#include "thumbnaildiskcache.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include <poppler-qt6.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+void ThumbnailThread::request(const QVector<int> &pages) {
+    QMutexLocker locker(&mutex);
+    pending = pages;
+    condition.wakeAll();
+}
+
+void ThumbnailThread::stop() {
+    stopped = true;
+    requestInterruption();
+    QMutexLocker locker(&mutex);
+    condition.wakeAll();
+}
+
+void ThumbnailThread::run() {
+    serve([this](int page, ThumbnailModel::Source &source) { return renderThumbnail(page, source); });
+}
+
+void ThumbnailThread::serve(const Renderer &render) {
+    for (int i = nextPage(); i >= 0; i = nextPage()) {
+        QElapsedTimer timer;
+        timer.start();
+        ThumbnailModel::Source source = ThumbnailModel::DiskCache;
+        QImage image = ThumbnailDiskCache::load(cacheDirectory, i);
+        if (image.isNull()) {
+            source = ThumbnailModel::Rendered;
+            image = render(i, source);
+            if (!stopped)
+                ThumbnailDiskCache::store(cacheDirectory, i, image);
+        }
+
+        if (!image.isNull() && !stopped)
+            emit thumbnailReady(i, image, source, timer.nsecsElapsed());
+    }
+}
+
+int ThumbnailThread::nextPage() {
+    QMutexLocker locker(&mutex);
+    while (pending.isEmpty() && !stopped)
+        condition.wait(&mutex);
+    return stopped ? -1 : pending.takeFirst();
+}
+
+void ThumbnailWorker::run() {
+    int threads = std::max(1, QThread::idealThreadCount() - 1);
+    std::vector<std::unique_ptr<QThread>> helpers;
+    for (int t = 1; t < threads; ++t) {
+        helpers.emplace_back(QThread::create([this]() { serveWithOwnDocument(); }));
+        helpers.back()->start(QThread::LowPriority);
+    }
+
+    serveWithOwnDocument();
+    for (auto &helper : helpers)
+        helper->wait();
+}
+
+void ThumbnailWorker::serveWithOwnDocument() {
+    // Loaded on the first cache miss, so a fully cached strip opens nothing.
+    std::unique_ptr<Poppler::Document> doc;
+    serve([this, &doc](int i, ThumbnailModel::Source &source) {
+        if (!doc) {
+            doc = Poppler::Document::load(filePath);
+            if (doc && doc->isLocked())
+                doc.reset();
+        }
+        if (!doc) return QImage();
+
+        std::unique_ptr<Poppler::Page> page = doc->page(i);
+        if (!page) return QImage();
+
+        // Many PDFs carry a small preview of each page.
+        QImage embedded = page->thumbnail();
+        if (!embedded.isNull()) {
+            source = ThumbnailModel::Embedded;
+            return embedded;
+        }
+
+        // Otherwise just enough resolution for the strip's width.
+        QSizeF size = page->pageSizeF();
+        double scale = ThumbnailModel::ThumbnailSize.width() / size.width();
+        QRect area(QPoint(0, 0), PageRenderer::scaledPageSize(size, scale));
+        return PageRenderer::renderPdfTile(page.get(), scale * 72.0, area, &stopped);
+    });
+}
+
+void DjvuThumbnailWorker::run() {
+    ThumbnailThread::run();
+    if (doc) ddjvu_document_release(doc);
+    doc = nullptr;
+}
+
+QImage DjvuThumbnailWorker::renderThumbnail(int i, ThumbnailModel::Source &source) {
+    if (!opened) {
+        opened = true;
+        doc = ddjvu_document_create_by_filename(djvu->context(), filePath.toUtf8().data(), TRUE);
+        if (doc && djvu->waitForDocument(doc, &stopped)) {
+            pages = ddjvu_document_get_pagenum(doc);
+            embedded = pages > 0 && PageRenderer::djvuHasThumbnails(doc);
+        }
+    }
+    if (!doc || i >= pages)
+        return QImage();
+
+    // Precomputed thumbnail chunks are tiny next to the page itself. Without
+    // them libdjvu would decode the whole page, so that case is left to the
+    // reduced-size render below.
+    if (embedded) {
+        bool ready = djvu->wait([this, i]() {
+            ddjvu_status_t status = ddjvu_thumbnail_status(doc, i, TRUE);
+            return status == DDJVU_JOB_NOTSTARTED ? DDJVU_JOB_FAILED : status;
+        }, &stopped);
+        if (ready) {
+            QImage image = PageRenderer::renderDjvuThumbnail(doc, i, ThumbnailModel::ThumbnailSize);
+            if (!image.isNull()) {
+                source = ThumbnailModel::Embedded;
+                return image;
+            }
+        }
+    }
+
+    ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, i);
+    if (!page)
+        return QImage();
+
+    QImage image;
+    if (djvu->waitForPage(page, &stopped))
+        image = PageRenderer::renderDjvu(page, double(ThumbnailModel::ThumbnailSize.width())
+                                                   / ddjvu_page_get_width(page));
+    ddjvu_page_release(page);
+    return image;
+}
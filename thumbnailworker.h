@@ -0,0 +1,100 @@
+#pragma once
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <functional>
+
+#include "djvubackend.h"
+#include "pagerenderer.h"
+#include "thumbnailmodel.h"
+
+// Produces page thumbnails off the GUI thread, on demand. Each request()
+// replaces the pages still waiting, so scrolling the strip quickly only
+// renders the rows it ends up on. Thumbnails found in the disk cache are
+// used as they are; everything else is rendered and then stored there.
+//
+// Several threads may serve the same queue; they take pages in request order,
+// so rows in view are started first.
+class ThumbnailThread : public QThread {
+    Q_OBJECT
+public:
+    ThumbnailThread(const QString &cacheDirectory, QObject *parent = nullptr)
+        : QThread(parent), cacheDirectory(cacheDirectory) {}
+
+    void request(const QVector<int> &pages);
+    void stop();
+
+signals:
+    // source is a ThumbnailModel::Source.
+    void thumbnailReady(int index, QImage image, int source, qint64 elapsedNanoseconds);
+
+protected:
+    void run() override;
+
+    // Takes pages off the queue until the thread is stopped; render is called
+    // for pages missing from the disk cache and reports the source it used.
+    // Safe to run on several threads.
+    using Renderer = std::function<QImage(int, ThumbnailModel::Source &)>;
+    void serve(const Renderer &render);
+
+    // Called on the worker thread for pages missing from the disk cache.
+    virtual QImage renderThumbnail(int, ThumbnailModel::Source &) { return QImage(); }
+
+    // Set by stop(); renders poll it so they can give up part way.
+    PageRenderer::CancelFlag stopped{false};
+
+private:
+    // Blocks until a page is requested; returns -1 once the thread is stopped.
+    int nextPage();
+
+    QString cacheDirectory;
+    QMutex mutex;
+    QWaitCondition condition;
+    QVector<int> pending;
+};
+
+// Renders PDF thumbnails on a small pool of threads. Each loads the file by
+// path rather than borrowing the GUI thread's document, which is replaced
+// whenever another file is opened.
+class ThumbnailWorker : public ThumbnailThread {
+    Q_OBJECT
+public:
+    ThumbnailWorker(const QString &filePath, const QString &cacheDirectory, QObject *parent = nullptr)
+        : ThumbnailThread(cacheDirectory, parent), filePath(filePath) {}
+
+protected:
+    void run() override;
+
+private:
+    void serveWithOwnDocument();
+
+    QString filePath;
+};
+
+// Renders DjVu thumbnails on a document of its own, opened on the shared
+// backend context; waits sleep until the backend reports progress. The
+// document is only opened once a thumbnail isn't in the disk cache.
+class DjvuThumbnailWorker : public ThumbnailThread {
+    Q_OBJECT
+public:
+    DjvuThumbnailWorker(DjvuBackend *djvu, const QString &filePath, const QString &cacheDirectory,
+                        QObject *parent = nullptr)
+        : ThumbnailThread(cacheDirectory, parent), djvu(djvu), filePath(filePath) {}
+
+protected:
+    void run() override;
+    QImage renderThumbnail(int i, ThumbnailModel::Source &source) override;
+
+private:
+    DjvuBackend *djvu;
+    QString filePath;
+    bool opened = false;
+    ddjvu_document_t *doc = nullptr;
+    int pages = 0;
+    bool embedded = false;
+};